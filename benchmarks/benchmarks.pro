@@ -0,0 +1,19 @@
+# QCommandEdit - a command input widget with history and tab completion
+# Copyright (C) 2018 Federico Ferri
+#
+# QtTest benchmarks; run with e.g.:
+#   ./tst_bench_qcommandedit -o results.xml,xml
+# (the offscreen platform is used unless QT_QPA_PLATFORM is set)
+
+QT += testlib widgets concurrent
+
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_bench_qcommandedit
+TEMPLATE = app
+
+include(../qcommandedit.pri)
+
+SOURCES += \
+    tst_bench_qcommandedit.cpp
@@ -0,0 +1,328 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QApplication>
+#include <QtTest>
+
+#include "qcommandcompletionindex.h"
+#include "qcommandedit.h"
+#include "qcommandhistory.h"
+#include "qcommandhistorymodel.h"
+#include "qshellcommandtokenizer.h"
+#include "qtablecommandtokenizer.h"
+
+/*
+ * Benchmarks of QCommandEdit, on generated histories, vocabularies and
+ * commands of 1k to 10M entries (or characters). Sizes above the value of
+ * the QCOMMANDEDIT_BENCH_MAX_SIZE environment variable (default 1000000)
+ * are skipped.
+ */
+class tst_Bench_QCommandEdit : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void navigateHistory_data();
+    void navigateHistory();
+    void mostRecentMatch_data();
+    void mostRecentMatch();
+    void typeWithGhost_data();
+    void typeWithGhost();
+    void setCompletion_data();
+    void setCompletion();
+    void insertTextAtCursor_data();
+    void insertTextAtCursor();
+    void tokenize_data();
+    void tokenize();
+
+private:
+    static void addSizes();
+    static bool skipSize(int size);
+    static void waitForIndex(QCommandEdit &edit);
+    static QStringList generateHistory(int size);
+    static QStringList generateWords(int size, const QString &prefix);
+    static QString generateCommand(int length);
+};
+
+// deterministic pseudo-random numbers (xorshift)
+static quint32 nextRandom(quint32 &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static const char * const commands[] = {
+    "ls", "cd", "grep", "find", "make", "git", "echo", "print", "import", "return"
+};
+
+void tst_Bench_QCommandEdit::addSizes()
+{
+    QTest::addColumn<int>("size");
+    QTest::newRow("1k") << 1000;
+    QTest::newRow("10k") << 10000;
+    QTest::newRow("100k") << 100000;
+    QTest::newRow("1M") << 1000000;
+    QTest::newRow("10M") << 10000000;
+}
+
+bool tst_Bench_QCommandEdit::skipSize(int size)
+{
+    bool ok;
+    int max = qEnvironmentVariableIntValue("QCOMMANDEDIT_BENCH_MAX_SIZE", &ok);
+    return size > (ok ? max : 1000000);
+}
+
+// the history is indexed in the background; wait for it
+void tst_Bench_QCommandEdit::waitForIndex(QCommandEdit &edit)
+{
+    QTRY_COMPARE_WITH_TIMEOUT(edit.historyModel()->history().unindexedCount(), 0, 600000);
+}
+
+QStringList tst_Bench_QCommandEdit::generateHistory(int size)
+{
+    QStringList history;
+    history.reserve(size);
+    quint32 state = 2463534242u;
+    for(int i = 0; i < size; i++)
+    {
+        quint32 r = nextRandom(state);
+        history << QString("%1 arg%2 --opt=%3").arg(QString::fromLatin1(commands[r % 10])).arg(r % 1000).arg(i);
+    }
+    return history;
+}
+
+QStringList tst_Bench_QCommandEdit::generateWords(int size, const QString &prefix)
+{
+    QStringList words;
+    words.reserve(size);
+    quint32 state = 88675123u;
+    for(int i = 0; i < size; i++)
+        words << prefix + QString::number(nextRandom(state), 36);
+    return words;
+}
+
+QString tst_Bench_QCommandEdit::generateCommand(int length)
+{
+    QString cmd;
+    cmd.reserve(length + 16);
+    quint32 state = 123456789u;
+    while(cmd.length() < length)
+    {
+        cmd += QString::fromLatin1(commands[nextRandom(state) % 10]);
+        cmd += ' ';
+    }
+    cmd.truncate(length);
+    return cmd;
+}
+
+void tst_Bench_QCommandEdit::navigateHistory_data()
+{
+    addSizes();
+}
+
+void tst_Bench_QCommandEdit::navigateHistory()
+{
+    QFETCH(int, size);
+    if(skipSize(size)) QSKIP("size above QCOMMANDEDIT_BENCH_MAX_SIZE");
+
+    QCommandEdit edit;
+    edit.setHistory(generateHistory(size));
+    edit.show();
+    waitForIndex(edit);
+    QTest::keyClicks(&edit, "grep arg");
+
+    // the matches are looked up once per prefix: change the prefix at each
+    // iteration, so that the lookup is measured too
+    int n = 0;
+    QBENCHMARK
+    {
+        QTest::keyClick(&edit, Qt::Key_Backspace);
+        QTest::keyClick(&edit, n++ % 2 ? '1' : '2');
+        for(int i = 0; i < 10; i++)
+            edit.navigateHistory(-1);
+        for(int i = 0; i < 10; i++)
+            edit.navigateHistory(1);
+    }
+}
+
+void tst_Bench_QCommandEdit::mostRecentMatch_data()
+{
+    addSizes();
+}
+
+void tst_Bench_QCommandEdit::mostRecentMatch()
+{
+    QFETCH(int, size);
+    if(skipSize(size)) QSKIP("size above QCOMMANDEDIT_BENCH_MAX_SIZE");
+
+    QCommandHistory history;
+    history.set(generateHistory(size));
+    QCommandHistory::Cursor cursor;
+    history.updateIndex();
+
+    const QString text = "grep arg12";
+    QBENCHMARK
+    {
+        // type the text one character at a time
+        for(int i = 1; i <= text.length(); i++)
+            history.mostRecentMatch(cursor, text.left(i));
+    }
+}
+
+void tst_Bench_QCommandEdit::typeWithGhost_data()
+{
+    QTest::addColumn<int>("size");
+    QTest::addColumn<bool>("search");
+    const char *names[] = {"1k", "10k", "100k", "1M", "10M"};
+    int sizes[] = {1000, 10000, 100000, 1000000, 10000000};
+    for(int i = 0; i < 5; i++)
+    {
+        QTest::newRow(qPrintable(QString("%1, keys").arg(QString::fromLatin1(names[i])))) << sizes[i] << false;
+        QTest::newRow(qPrintable(QString("%1, search").arg(QString::fromLatin1(names[i])))) << sizes[i] << true;
+    }
+}
+
+void tst_Bench_QCommandEdit::typeWithGhost()
+{
+    QFETCH(int, size);
+    QFETCH(bool, search);
+    if(skipSize(size)) QSKIP("size above QCOMMANDEDIT_BENCH_MAX_SIZE");
+
+    QCommandEdit edit;
+    edit.setHistory(generateHistory(size));
+    edit.setShowMatchingHistory(true);
+    edit.show();
+    waitForIndex(edit);
+
+    const QString text = "grep arg12";
+    if(search)
+    {
+        // the searches for the ghost, as run in the background, on the
+        // snapshot of the edit's history
+        QSharedPointer<const QCommandHistory> snapshot = edit.historyModel()->snapshot();
+        QCommandHistory::Cursor cursor;
+        QBENCHMARK
+        {
+            for(int i = 1; i <= text.length(); i++)
+                snapshot->mostRecentMatch(cursor, text.left(i));
+        }
+    }
+    else
+    {
+        // key press, textEdited and searchMatchingHistoryAndShowGhost(),
+        // without the searches themselves (see the search rows)
+        QBENCHMARK
+        {
+            edit.clear();
+            QTest::keyClicks(&edit, text);
+        }
+    }
+}
+
+void tst_Bench_QCommandEdit::setCompletion_data()
+{
+    addSizes();
+}
+
+void tst_Bench_QCommandEdit::setCompletion()
+{
+    QFETCH(int, size);
+    if(skipSize(size)) QSKIP("size above QCOMMANDEDIT_BENCH_MAX_SIZE");
+
+    // Tab => askCompletion => setCompletion (longest common prefix
+    // accepted, first completion selected)
+    QStringList completion = generateWords(size, "common_prefix_");
+    QCommandEdit edit;
+    edit.setCompletionCacheEnabled(false);
+    edit.setAutoAcceptLongestCommonCompletionPrefix(true);
+    connect(&edit, &QCommandEdit::askCompletion, &edit, [&]() {
+        edit.setCompletion(completion);
+    });
+    edit.show();
+
+    QBENCHMARK
+    {
+        edit.resetCompletion();
+        edit.setText("foo ");
+        QTest::keyClick(&edit, Qt::Key_Tab);
+    }
+}
+
+void tst_Bench_QCommandEdit::insertTextAtCursor_data()
+{
+    addSizes();
+}
+
+void tst_Bench_QCommandEdit::insertTextAtCursor()
+{
+    QFETCH(int, size);
+    if(skipSize(size)) QSKIP("size above QCOMMANDEDIT_BENCH_MAX_SIZE");
+
+    QCommandEdit edit;
+    edit.setMaxLength(size + 16);
+    edit.setText(generateCommand(size));
+    edit.setCursorPosition(size / 2);
+
+    QBENCHMARK
+    {
+        edit.insertTextAtCursor("word", true);
+    }
+}
+
+void tst_Bench_QCommandEdit::tokenize_data()
+{
+    QTest::addColumn<int>("size");
+    QTest::addColumn<int>("tokenizer");
+    const char *names[] = {"simple", "table", "shell"};
+    int sizes[] = {1000, 10000, 100000, 1000000, 10000000};
+    for(int s : sizes)
+        for(int t = 0; t < 3; t++)
+            QTest::newRow(qPrintable(QString("%1 chars, %2").arg(s).arg(QString::fromLatin1(names[t])))) << s << t;
+}
+
+void tst_Bench_QCommandEdit::tokenize()
+{
+    QFETCH(int, size);
+    QFETCH(int, tokenizer);
+    if(skipSize(size)) QSKIP("size above QCOMMANDEDIT_BENCH_MAX_SIZE");
+
+    QString cmd = generateCommand(size);
+    QSimpleCommandTokenizer simple;
+    QTableCommandTokenizer<> table;
+    QShellCommandTokenizer shell;
+    QCommandTokenizer *t = tokenizer == 0 ? static_cast<QCommandTokenizer*>(&simple)
+                         : tokenizer == 1 ? static_cast<QCommandTokenizer*>(&table)
+                         : static_cast<QCommandTokenizer*>(&shell);
+
+    QBENCHMARK
+    {
+        t->setCommand(cmd);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if(!qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    QApplication app(argc, argv);
+    tst_Bench_QCommandEdit tc;
+    QTEST_SET_MAIN_SOURCE_PATH
+    return QTest::qExec(&tc, argc, argv);
+}
+
+#include "tst_bench_qcommandedit.moc"
@@ -31,7 +31,9 @@ int main(int argc, char *argv[])
     qDebug() << "command: " << cmd;
     for(const QCommandTokenizer::Token &tok : t.getTokens())
         qDebug() << tok.token_ << tok.start_ << tok.end_;
-    qDebug() << "token at 9: " << t.getTokenAtCharPos(9).token_;
+    QCommandTokenizer::TokenLookup at = t.findToken(9);
+    if(at.kind_ == QCommandTokenizer::TokenLookup::InToken)
+        qDebug() << "token at 9: " << t.tokenAt(at.index_).token_;
     return 0;
 #else
     MainWindow w;
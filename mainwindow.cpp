@@ -16,7 +16,7 @@
  */
 #include "mainwindow.h"
 #include "ui_mainwindow.h"
-#include "qcommandtokenizer.h"
+#include "qtablecommandtokenizer.h"
 
 #include <QDebug>
 
@@ -50,6 +50,7 @@ MainWindow::MainWindow(QWidget *parent) :
           << "while" << "with" << "yield";
 
     ui->listWords->addItems(words_);
+    completionIndex_.build(words_);
 
     ui->commandEdit->setFocus();
 }
@@ -64,34 +65,32 @@ void MainWindow::onExecute(const QString &s)
     history_.append(s);
     ui->textCmdLog->append(s);
     ui->commandEdit->clear();
-    ui->commandEdit->setHistory(history_);
+    ui->commandEdit->appendHistory(s);
 }
 
 void MainWindow::onAskCompletion(const QString &cmd, int cursorPos)
 {
-    QSimpleCommandTokenizer t;
+    QTableCommandTokenizer<> t;
     t.setCommand(cmd);
-    try
+    QCommandTokenizer::TokenLookup lookup = t.findToken(cursorPos);
+    if(lookup.kind_ != QCommandTokenizer::TokenLookup::InToken)
     {
-        QCommandTokenizer::Token tok = t.getTokenAtCharPos(cursorPos);
-
-        if(cursorPos != tok.end_)
-            throw "Not completing at middle of token";
-
-        QStringList comp;
-        for(const QString &w : words_)
-            if(w.startsWith(tok.token_))
-                comp << w.mid(tok.token_.length());
-
-        ui->commandEdit->setCompletion(comp);
-
-        qDebug() << "Completion:" << comp;
+        qDebug() << "No token";
+        return;
     }
-    catch(const char *ex)
+
+    QCommandTokenizer::TokenView tok = t.tokenAt(lookup.index_);
+    if(cursorPos != tok.end_)
     {
-        qDebug() << ex;
+        qDebug() << "Not completing at middle of token";
         return;
     }
+
+    QStringList comp = completionIndex_.complete(tok.token_.toString());
+
+    ui->commandEdit->setCompletion(comp);
+
+    qDebug() << "Completion:" << comp;
 }
 
 void MainWindow::onEscape()
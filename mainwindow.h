@@ -20,6 +20,8 @@
 #include <QMainWindow>
 #include <QStringList>
 
+#include "qcommandcompletionindex.h"
+
 namespace Ui {
 class MainWindow;
 }
@@ -41,6 +43,7 @@ private:
     Ui::MainWindow *ui;
     QStringList history_;
     QStringList words_;
+    QCommandCompletionIndex completionIndex_;
 };
 
 #endif // MAINWINDOW_H
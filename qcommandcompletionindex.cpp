@@ -0,0 +1,142 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "qcommandcompletionindex.h"
+
+#include <algorithm>
+
+QCommandCompletionIndex::Range::Range()
+    : begin_(nullptr),
+      end_(nullptr)
+{
+}
+
+/*!
+ * \brief Return the words of the range with the first prefixLength
+ * characters removed, i.e. in the form expected by QCommandEdit::setCompletion
+ */
+QStringList QCommandCompletionIndex::Range::completions(int prefixLength) const
+{
+    QStringList result;
+    result.reserve(size());
+    for(const QString *w = begin_; w != end_; ++w)
+        result << w->mid(prefixLength);
+    return result;
+}
+
+QCommandCompletionIndex::QCommandCompletionIndex()
+{
+}
+
+QCommandCompletionIndex::QCommandCompletionIndex(const QStringList &words)
+{
+    build(words);
+}
+
+/*!
+ * \brief Replace the content of the index with the given words
+ *
+ * Sorts once, which is much faster than inserting words one by one.
+ */
+void QCommandCompletionIndex::build(const QStringList &words)
+{
+    words_.clear();
+    words_.reserve(words.size());
+    for(const QString &w : words)
+        words_.append(w);
+    std::sort(words_.begin(), words_.end());
+    words_.erase(std::unique(words_.begin(), words_.end()), words_.end());
+    words_.squeeze();
+}
+
+/*!
+ * \brief Add a word to the index
+ * \return false if the word was already present
+ */
+bool QCommandCompletionIndex::insert(const QString &word)
+{
+    QVector<QString>::iterator it = std::lower_bound(words_.begin(), words_.end(), word);
+    if(it != words_.end() && *it == word)
+        return false;
+    words_.insert(it, word);
+    return true;
+}
+
+/*!
+ * \brief Remove a word from the index
+ * \return false if the word was not present
+ */
+bool QCommandCompletionIndex::remove(const QString &word)
+{
+    QVector<QString>::iterator it = std::lower_bound(words_.begin(), words_.end(), word);
+    if(it == words_.end() || *it != word)
+        return false;
+    words_.erase(it);
+    return true;
+}
+
+void QCommandCompletionIndex::clear()
+{
+    words_.clear();
+}
+
+bool QCommandCompletionIndex::contains(const QString &word) const
+{
+    QVector<QString>::const_iterator it = std::lower_bound(words_.cbegin(), words_.cend(), word);
+    return it != words_.cend() && *it == word;
+}
+
+int QCommandCompletionIndex::count() const
+{
+    return words_.size();
+}
+
+/*!
+ * \brief Return the word at the given position, in sorted order
+ */
+const QString & QCommandCompletionIndex::at(int index) const
+{
+    return words_.at(index);
+}
+
+/*!
+ * \brief Find the words starting with the given prefix
+ * \return The (possibly empty) range of matching words, in sorted order
+ */
+QCommandCompletionIndex::Range QCommandCompletionIndex::find(const QString &prefix) const
+{
+    // words starting with prefix are not less than prefix, and are followed
+    // by the words greater than prefix which don't start with it
+    const QString *words = words_.constData();
+    const QString *first = std::lower_bound(words, words + words_.size(), prefix);
+    const QString *last = std::upper_bound(first, words + words_.size(), prefix,
+        [](const QString &p, const QString &w) {
+            return !w.startsWith(p);
+        });
+    Range range;
+    range.begin_ = first;
+    range.end_ = last;
+    return range;
+}
+
+/*!
+ * \brief Return the completions of prefix, as expected by
+ * QCommandEdit::setCompletion (the prefix is removed from every word)
+ */
+QStringList QCommandCompletionIndex::complete(const QString &prefix) const
+{
+    return find(prefix).completions(prefix.length());
+}
@@ -0,0 +1,70 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef QCOMMANDCOMPLETIONINDEX_H
+#define QCOMMANDCOMPLETIONINDEX_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+/*!
+ * \brief Prefix index over a dictionary of words, for completion
+ *
+ * Words are kept in a sorted array without duplicates, so that all the words
+ * starting with a given prefix form a contiguous Range, found with two binary
+ * searches. A Range only refers to the words stored in the index (no string
+ * is copied), and is invalidated by any modification of the index.
+ *
+ * Typical use in a handler of QCommandEdit::askCompletion:
+ *
+ *     edit->setCompletion(index.complete(token));
+ */
+class QCommandCompletionIndex
+{
+public:
+    struct Range
+    {
+        const QString *begin_;
+        const QString *end_;
+
+        Range();
+        const QString * begin() const { return begin_; }
+        const QString * end() const { return end_; }
+        int size() const { return int(end_ - begin_); }
+        bool isEmpty() const { return begin_ == end_; }
+        QStringList completions(int prefixLength) const;
+    };
+
+    QCommandCompletionIndex();
+    explicit QCommandCompletionIndex(const QStringList &words);
+
+    void build(const QStringList &words);
+    bool insert(const QString &word);
+    bool remove(const QString &word);
+    void clear();
+    bool contains(const QString &word) const;
+    int count() const;
+    const QString & at(int index) const;
+
+    Range find(const QString &prefix) const;
+    QStringList complete(const QString &prefix) const;
+
+private:
+    QVector<QString> words_;
+};
+
+#endif // QCOMMANDCOMPLETIONINDEX_H
@@ -0,0 +1,62 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef QCOMMANDCOMPLETIONPROVIDER_H
+#define QCOMMANDCOMPLETIONPROVIDER_H
+
+#include <QAtomicInt>
+#include <QStringList>
+
+/*!
+ * \brief Interface for supplying completions to QCommandEdit
+ *
+ * An alternative to answering the askCompletion() signal: when a provider
+ * is set with QCommandEdit::setCompletionProvider(), complete() is called in
+ * a worker thread (unless isAsynchronous() returns false), and its result is
+ * applied only if the text and cursor position are still those of the
+ * request.
+ */
+class QCommandCompletionProvider
+{
+public:
+    virtual ~QCommandCompletionProvider() {}
+
+    struct Request
+    {
+        int id_;
+        QString text_;
+        int cursorPos_;
+    };
+
+    /*!
+     * \brief Compute the completions for a request
+     * \param request The request (a snapshot of the editor state)
+     * \param cancelled Becomes non-zero when the result is no longer needed,
+     * e.g. because the user kept typing; long computations should check it
+     * and return early
+     * \return The list of completions, as for QCommandEdit::setCompletion()
+     */
+    virtual QStringList complete(const Request &request, const QAtomicInt &cancelled) = 0;
+
+    /*!
+     * \brief Whether complete() must be called in a worker thread
+     *
+     * Fast providers can return false to be called directly.
+     */
+    virtual bool isAsynchronous() const { return true; }
+};
+
+#endif // QCOMMANDCOMPLETIONPROVIDER_H
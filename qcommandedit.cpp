@@ -15,34 +15,80 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "qcommandedit.h"
+#include "qcommandhistoryjournal.h"
+#include "qcommandhistorymodel.h"
+#include "qtablecommandtokenizer.h"
 
 #include <QApplication>
+#include <QThreadPool>
 #include <QTimer>
+#include <QtConcurrent>
 #include <QTextLayout>
 #include <QPainter>
 #include <QToolTip>
 
+#include <algorithm>
+#include <cstring>
+
 QCommandEdit::QCommandEdit(QWidget *parent)
     : QLineEdit(parent),
       showMatchingHistory_(false),
-      autoAcceptLongestCommonCompletionPrefix_(true)
+      autoAcceptLongestCommonCompletionPrefix_(true),
+      historyModel_(nullptr),
+      historyJournal_(nullptr),
+      historySearch_(new QCommandHistorySearch),
+      historySearchMode_(QCommandHistorySearch::Substring),
+      historySearchPool_(new QThreadPool(this)),
+      historySearchWatcher_(new QFutureWatcher<HistorySearchResult>(this)),
+      historySearchGeneration_(0),
+      historySearchPending_(false),
+      completionProvider_(nullptr),
+      completionPool_(new QThreadPool(this)),
+      completionWatcher_(new QFutureWatcher<CompletionResult>(this)),
+      completionRequestCounter_(0),
+      completionCacheEnabled_(true),
+      discardStaleCompletions_(false),
+      inputCoalescingBudget_(-1),
+      textEditedTimer_(new QTimer(this)),
+      keyPressTime_(-1),
+      keyPressStart_(-1)
 {
+    // one search at a time; QCommandHistorySearch may use the global pool
+    historySearchPool_->setMaxThreadCount(1);
+
     historyState_.reset();
+    historyState_.filterValid_ = false;
+    historySearchState_.reset();
     completionState_.reset();
+    completionCache_.valid_ = false;
+    textEditedTimer_->setSingleShot(true);
 
     connect(this, &QCommandEdit::returnPressed, this, &QCommandEdit::onReturnPressed);
     connect(this, &QCommandEdit::escapePressed, this, &QCommandEdit::onEscapePressed);
     connect(this, &QCommandEdit::upPressed, this, &QCommandEdit::onUpPressed);
     connect(this, &QCommandEdit::downPressed, this, &QCommandEdit::onDownPressed);
+    connect(this, &QCommandEdit::reverseSearchPressed, this, &QCommandEdit::onReverseSearchPressed);
     connect(this, &QCommandEdit::tabPressed, this, &QCommandEdit::onTabPressed);
     connect(this, &QCommandEdit::shiftTabPressed, this, &QCommandEdit::onShiftTabPressed);
     connect(this, &QCommandEdit::textEdited, this, &QCommandEdit::onTextEdited);
+    connect(textEditedTimer_, &QTimer::timeout, this, &QCommandEdit::processTextEdited);
     connect(this, &QCommandEdit::selectionChanged, this, &QCommandEdit::onSelectionChanged);
     connect(this, &QCommandEdit::cursorPositionChanged, this, &QCommandEdit::onCursorPositionChanged);
+    connect(historySearchWatcher_, &QFutureWatcherBase::finished, this, &QCommandEdit::onHistorySearchFinished);
+    connect(completionWatcher_, &QFutureWatcherBase::finished, this, &QCommandEdit::onCompletionFinished);
+    setHistoryModel(nullptr);
 
     installEventFilter(this);
 }
 
+QCommandEdit::~QCommandEdit()
+{
+    historySearchCancel_.storeRelease(1);
+    historySearchWatcher_->waitForFinished();
+    completionState_.reset();
+    completionPool_->waitForDone();
+}
+
 void QCommandEdit::setShowMatchingHistory(bool show)
 {
     showMatchingHistory_ = show;
@@ -55,38 +101,293 @@ void QCommandEdit::setAutoAcceptLongestCommonCompletionPrefix(bool accept)
     autoAcceptLongestCommonCompletionPrefix_ = accept;
 }
 
+/*!
+ * \brief Coalesce the work done after each edit
+ * \param budget The maximum delay in milliseconds, or -1 to disable
+ *
+ * By default, every edit resets the completion and searches the history for
+ * the ghost text right away. With coalescing enabled, that work is deferred
+ * by up to budget milliseconds (0 means to the next event loop iteration), and
+ * a burst of edits (key repeat, a paste delivered as many key events) is
+ * processed once, for the final text. The textEditedCoalesced() signal is
+ * emitted at that point, e.g. for refreshing a calltip.
+ *
+ * Keys that use the result (Tab, Up, Down, Return, ...) process pending edits
+ * before doing anything else.
+ */
+void QCommandEdit::setInputCoalescing(int budget)
+{
+    inputCoalescingBudget_ = budget;
+    if(budget < 0)
+        flushTextEdited();
+}
+
+/*!
+ * \brief Return the history (e.g. for inspecting its memory usage)
+ */
+const QCommandHistory & QCommandEdit::history() const
+{
+    return historyModel_->history();
+}
+
+/*!
+ * \brief Use a history shared with other widgets
+ * \param model The history model (not owned), or nullptr for a private one
+ *
+ * The entries are stored once in the model, whatever the number of widgets
+ * using it, and changes made thru any of them (e.g. with appendHistory())
+ * are seen by all. The model must outlive the widget, or be detached from it
+ * before being destroyed.
+ */
+void QCommandEdit::setHistoryModel(QCommandHistoryModel *model)
+{
+    if(historyModel_ && historyModel_ == model)
+        return;
+
+    if(historyModel_)
+    {
+        cancelHistorySearch();
+        historySearchWatcher_->waitForFinished();
+        if(!historySearch_)
+            historySearch_ = historySearchWatcher_->result().search_;
+        historySearch_->reset();
+        historyState_.ghostCursor_ = QCommandHistory::Cursor();
+        disconnect(historyModel_, nullptr, this, nullptr);
+        if(historyModel_->parent() == this)
+            delete historyModel_;
+    }
+
+    historyModel_ = model ? model : new QCommandHistoryModel(this);
+    connect(historyModel_, &QCommandHistoryModel::historyReset, this, &QCommandEdit::onHistoryReset);
+    connect(historyModel_, &QCommandHistoryModel::entryAppended, this, &QCommandEdit::onHistoryEntryAppended);
+    connect(historyModel_, &QCommandHistoryModel::entriesDropped, this, &QCommandEdit::onHistoryEntriesDropped);
+    connect(historyModel_, &QCommandHistoryModel::entryRemoved, this, &QCommandEdit::onHistoryEntryRemoved);
+    onHistoryReset();
+}
+
+QCommandHistoryModel * QCommandEdit::historyModel() const
+{
+    return historyModel_;
+}
+
+/*!
+ * \brief Replace the history content with the content of a history file
+ * \param fileName The file name, as written by saveHistory()
+ * \return true on success
+ *
+ * The file is memory-mapped, so this is fast even for very large histories;
+ * its entries are indexed for prefix searches in a background thread (until
+ * then, searches scan them).
+ */
+bool QCommandEdit::loadHistory(const QString &fileName)
+{
+    return historyModel_->load(fileName);
+}
+
+/*!
+ * \brief Write the history content to a history file
+ * \param fileName The file name
+ * \return true on success
+ *
+ * Overwriting the file the history was loaded from fails on Windows (see
+ * QCommandHistoryFile::write()).
+ */
+bool QCommandEdit::saveHistory(const QString &fileName) const
+{
+    return historyModel_->history().save(fileName);
+}
+
+/*!
+ * \brief Set a journal where entries added with appendHistory() are recorded
+ * \param journal The journal (not owned), or nullptr
+ *
+ * The journal is written by a background thread, so appending history never
+ * waits for disk I/O.
+ */
+void QCommandEdit::setHistoryJournal(QCommandHistoryJournal *journal)
+{
+    historyJournal_ = journal;
+}
+
+/*!
+ * \brief Set how the reverse history search (Ctrl+R) matches entries
+ * \param mode Substring or fuzzy (subsequence) match
+ */
+void QCommandEdit::setHistorySearchMode(QCommandHistorySearch::Mode mode)
+{
+    historySearchMode_ = mode;
+}
+
+/*!
+ * \brief Set an object computing completions, instead of askCompletion()
+ * \param provider The provider (not owned; it must outlive this widget, or be
+ * replaced before being destroyed), or nullptr for using the askCompletion()
+ * signal
+ *
+ * Completions still being computed by the previous provider are cancelled,
+ * and waited for.
+ */
+void QCommandEdit::setCompletionProvider(QCommandCompletionProvider *provider)
+{
+    completionState_.reset();
+    completionPool_->waitForDone();
+    completionProvider_ = provider;
+    invalidateCompletionCache(); // (results of the previous provider)
+}
+
+/*!
+ * \brief Return the id of the pending completion request, or -1 if none
+ *
+ * A host answering askCompletion() asynchronously can save this id, and
+ * pass it to setCompletionForRequest(), so that stale answers are discarded.
+ */
+int QCommandEdit::completionRequestId() const
+{
+    return completionState_.requestId_;
+}
+
 void QCommandEdit::paintEvent(QPaintEvent *event)
 {
+    qint64 start = profiler_ ? profiler_->now() : 0;
+
     QLineEdit::paintEvent(event);
+    paintGhost();
+
+    if(profiler_)
+    {
+        recordLatency(QCommandEditProfiler::Paint, start);
+        if(keyPressTime_ >= 0)
+        {
+            recordLatency(QCommandEditProfiler::KeyToPaint, keyPressTime_);
+            keyPressTime_ = -1;
+        }
+    }
+}
 
+void QCommandEdit::paintGhost()
+{
     /* show ghost suffix. only shown if:
      * - widget has focus
      * - cursor is at end
      * - there is some text
+     * - the text was not edited since the ghost was searched (see
+     *   setInputCoalescing())
      */
 
     if(!hasFocus()) return;
     if(ghostSuffix_.isEmpty()) return;
     QString txt = text();
-    if(txt.isEmpty()) return;
+    if(txt.isEmpty() || txt != ghostText_) return;
     if(cursorPosition() < txt.length()) return;
 
     ensurePolished();
     QRect cr = cursorRect();
     QPoint pos = cr.topRight() - QPoint(cr.width() / 2, 0);
+
+    // the layout is cached, and only redone when the suffix or font change
+    if(ghostLayout_.text() != ghostSuffix_ || ghostLayout_.font() != font())
+    {
+        ghostLayout_.setText(ghostSuffix_);
+        ghostLayout_.setFont(font());
+        ghostLayout_.beginLayout();
+        QTextLine line = ghostLayout_.createLine();
+        line.setNumColumns(ghostSuffix_.length());
+        line.setPosition(QPointF(0, 0));
+        ghostLayout_.endLayout();
+    }
+
+    QRect clip(pos.x(), 0, width() - pos.x(), height());
     QPainter p(this);
+    p.setClipRect(clip);
     p.setPen(QPen(Qt::gray, 1));
-    QTextLayout l(ghostSuffix_, font());
-    l.beginLayout();
-    QTextLine line = l.createLine();
-    line.setLineWidth(width() - pos.x());
-    line.setPosition(pos);
-    l.endLayout();
-    l.draw(&p, QPoint(0, 0));
+    ghostLayout_.draw(&p, pos);
+    ghostRect_ = ghostLayout_.boundingRect().translated(pos).toAlignedRect() & clip;
+}
+
+/*
+ * Set the ghost (the suffix of the matching history entry shown after the
+ * text) and schedule a repaint of the area it covers.
+ *
+ * The ghost is shown only while the text is ghostText_ (see paintGhost()),
+ * so a change of either one may show or hide it.
+ */
+void QCommandEdit::setGhost(const QString &text, const QString &suffix)
+{
+    if(ghostText_ == text && ghostSuffix_ == suffix) return;
+    ghostText_ = text;
+    ghostSuffix_ = suffix;
+    if(suffix.isEmpty() && ghostRect_.isEmpty()) return;
+
+    // old ghost, and area where the new one will be drawn
+    QRect cr = cursorRect();
+    update(ghostRect_ | QRect(cr.left(), 0, width() - cr.left(), height()));
+    ghostRect_ = QRect();
 }
 
 void QCommandEdit::keyPressEvent(QKeyEvent *event)
 {
+    if(!profiler_)
+    {
+        handleKeyPress(event);
+        return;
+    }
+
+    qint64 start = profiler_->now();
+    handleKeyPress(event);
+    recordLatency(QCommandEditProfiler::KeyPress, start);
+    endKeyPress();
+}
+
+QCommandEdit::KeyPressState QCommandEdit::currentKeyPressState() const
+{
+    KeyPressState state;
+    state.text_ = text();
+    state.cursor_ = cursorPosition();
+    state.selectionStart_ = selectionStart();
+    state.selectionLength_ = selectedText().length();
+    state.ghostSuffix_ = ghostSuffix_;
+    state.searchActive_ = historySearchState_.active_;
+    state.searchQuery_ = historySearchState_.query_;
+    return state;
+}
+
+bool QCommandEdit::KeyPressState::operator==(const KeyPressState &o) const
+{
+    return text_ == o.text_
+            && cursor_ == o.cursor_
+            && selectionStart_ == o.selectionStart_
+            && selectionLength_ == o.selectionLength_
+            && ghostSuffix_ == o.ghostSuffix_
+            && searchActive_ == o.searchActive_
+            && searchQuery_ == o.searchQuery_;
+}
+
+/*!
+ * \brief Keep the time of the key press being handled for measuring
+ * KeyToPaint, if it changed the text, the cursor, the ghost or the search
+ *
+ * Other key presses (modifiers, keys doing nothing) are not followed by a
+ * paint of their own, so the next paint (e.g. the cursor blinking) would
+ * not measure them.
+ */
+void QCommandEdit::endKeyPress()
+{
+    if(keyPressStart_ < 0)
+        return;
+    if(keyPressTime_ < 0 && !(currentKeyPressState() == keyPressState_))
+        keyPressTime_ = keyPressStart_;
+    keyPressStart_ = -1;
+}
+
+void QCommandEdit::handleKeyPress(QKeyEvent *event)
+{
+    if(historySearchState_.active_ && historySearchKeyPressed(event))
+        return;
+    if(event->key() == Qt::Key_R && event->modifiers() == Qt::ControlModifier)
+    {
+        Q_EMIT reverseSearchPressed();
+        return;
+    }
     if(event->key() == Qt::Key_Escape)
     {
         Q_EMIT escapePressed();
@@ -109,15 +410,27 @@ bool QCommandEdit::eventFilter(QObject *obj, QEvent *event)
 {
     if(event->type() == QEvent::KeyPress)
     {
+        // the next paint shows the feedback for the first unpainted key press
+        // (see endKeyPress())
+        if(profiler_ && keyPressTime_ < 0)
+        {
+            keyPressStart_ = profiler_->now();
+            keyPressState_ = currentKeyPressState();
+        }
+
         QKeyEvent *keyEvent = static_cast<QKeyEvent*>(event);
+        if(keyEvent->key() == Qt::Key_Tab || keyEvent->key() == Qt::Key_Backtab)
+            stopHistorySearch(true);
         if(keyEvent->key() == Qt::Key_Tab)
         {
             Q_EMIT tabPressed();
+            endKeyPress();
             return true;
         }
         if(keyEvent->key() == Qt::Key_Backtab)
         {
             Q_EMIT shiftTabPressed();
+            endKeyPress();
             return true;
         }
     }
@@ -129,9 +442,11 @@ bool QCommandEdit::eventFilter(QObject *obj, QEvent *event)
  */
 void QCommandEdit::clear()
 {
+    textEditedTimer_->stop();
     setText("");
-    ghostSuffix_ = "";
+    setGhost("", "");
     historyState_.reset();
+    historySearchState_.reset();
     completionState_.reset();
     setToolTipAtCursor("");
 }
@@ -142,10 +457,41 @@ void QCommandEdit::clear()
  */
 void QCommandEdit::setHistory(const QStringList &history)
 {
-    if(historyState_.index_ != -1)
-        clear();
-    historyState_.history_ = history;
-    historyState_.reset();
+    historyModel_->set(history);
+}
+
+/*!
+ * \brief Append an entry to the history
+ * \param entry The new entry
+ *
+ * Unlike setHistory(), this does not copy the history, and only updates
+ * the history index incrementally.
+ */
+void QCommandEdit::appendHistory(const QString &entry)
+{
+    historyModel_->append(entry);
+    if(historyJournal_)
+        historyJournal_->append(entry);
+}
+
+/*!
+ * \brief Remove an entry from the history
+ * \param index Index of the history entry
+ */
+void QCommandEdit::removeHistory(int index)
+{
+    historyModel_->remove(index);
+}
+
+/*!
+ * \brief Limit the number of history entries
+ * \param capacity The maximum number of entries, or 0 for no limit
+ *
+ * When the limit is exceeded, the oldest entries are dropped.
+ */
+void QCommandEdit::setHistoryCapacity(int capacity)
+{
+    historyModel_->setCapacity(capacity);
 }
 
 /*!
@@ -156,12 +502,14 @@ void QCommandEdit::navigateHistory(int delta)
 {
     if(delta == 0) return;
 
+    flushTextEdited();
+
     // clip delta to +1/-1:
     delta = (delta < -1 ? -1 : delta > 1 ? 1 : delta);
 
     // compute actual index (-1 => last):
     int newIndex = historyState_.index_;
-    if(newIndex == -1) newIndex = historyState_.history_.length();
+    if(newIndex == -1) newIndex = historyModel_->history().count();
 
     if(historyState_.prefixFilter_.isEmpty())
     {
@@ -170,23 +518,57 @@ void QCommandEdit::navigateHistory(int delta)
         return;
     }
 
-    // search matching history
-    while(1)
+    // the list of matching entries is built once per filter prefix:
+    if(!historyState_.filterValid_ || historyState_.filterPrefix_ != historyState_.prefixFilter_)
     {
-        newIndex += delta;
-        if(newIndex < 0 || newIndex >= historyState_.history_.length())
-            break;
-        if(historyState_.history_[newIndex].startsWith(historyState_.prefixFilter_))
-        {
-            setHistoryIndex(newIndex);
+        historyState_.filterMatches_ = historyModel_->matchingIds(historyState_.prefixFilter_);
+        historyState_.filterPrefix_ = historyState_.prefixFilter_;
+        historyState_.filterValid_ = true;
+        historyState_.filterPos_ = historyState_.filterMatches_.size();
+    }
+    const QCommandHistory &history = historyModel_->history();
+    const QVector<int> &matches = historyState_.filterMatches_;
+    int newId = history.idAt(newIndex);
+
+    // locate the current entry in the list of matches; when stepping thru
+    // matches, it is where the previous step left it:
+    int pos = historyState_.filterPos_;
+    auto isAt = [&](int p) {
+        return p < matches.size() ? matches[p] == newId : newId == history.idAt(history.count());
+    };
+    if(!isAt(pos))
+        pos = std::lower_bound(matches.begin(), matches.end(), newId) - matches.begin();
+    int newPos = isAt(pos) || delta < 0 ? pos + delta : pos;
+
+    // the position of the entry to show, count() for the original edit state
+    int found;
+    if(newPos < 0)
+    {
+        return;
+    }
+    else if(newPos < matches.size())
+    {
+        // (matches may include entries dropped by the capacity limit)
+        found = history.indexOf(matches[newPos]);
+        if(found < 0)
             return;
-        }
+        historyState_.filterPos_ = newPos;
+    }
+    else
+    {
+        found = history.count();
+    }
+
+    if(found < history.count())
+    {
+        setHistoryIndex(found);
     }
-    if(newIndex >= historyState_.history_.length())
+    else
     {
         // reached history end => go back at the orginal edit state
+        historyState_.filterPos_ = matches.size();
         QString savedFilter = historyState_.prefixFilter_;
-        setHistoryIndex(newIndex);
+        setHistoryIndex(history.count());
         historyState_.prefixFilter_ = savedFilter;
     }
 }
@@ -197,12 +579,12 @@ void QCommandEdit::navigateHistory(int delta)
  */
 void QCommandEdit::setHistoryIndex(int index)
 {
-    if(index < 0 || index > historyState_.history_.length())
+    if(index < 0 || index > historyModel_->history().count())
         return;
 
-    ghostSuffix_ = "";
+    setGhost("", "");
 
-    if(index >= historyState_.history_.length())
+    if(index >= historyModel_->history().count())
     {
         // going past last item resets the editor to whatever text
         // has been entered before beginning history navigation
@@ -213,35 +595,81 @@ void QCommandEdit::setHistoryIndex(int index)
     else
     {
         historyState_.index_ = index;
-        setText(historyState_.history_[index]);
+        historyState_.id_ = historyModel_->history().idAt(index);
+        setText(historyModel_->history().at(index));
     }
 
     QTimer::singleShot(0, this, &QCommandEdit::moveCursorToEnd);
     setToolTipAtCursor("");
 }
 
-static QString longestCommonPrefix(const QStringList &strs)
+/*!
+ * \brief Start a reverse incremental history search (like Ctrl+R in bash)
+ *
+ * While searching, typed text is used as the search query, Ctrl+R looks for
+ * the next older match, Esc cancels, and any other key accepts the match.
+ */
+void QCommandEdit::startHistorySearch()
 {
-    QString result;
-    if(strs.isEmpty()) return result;
-    result = strs[0];
-    for(int i = 1; i < strs.size(); i++)
+    if(historySearchState_.active_) return;
+
+    flushTextEdited();
+    historySearchState_.reset();
+    historySearchState_.active_ = true;
+    historySearchState_.savedText_ = text();
+    setGhost("", "");
+    updateHistorySearch(historyModel_->history().idAt(historyModel_->history().count()));
+}
+
+/*!
+ * \brief Stop the reverse incremental history search
+ * \param accept If true, keep the matched entry in the editor, otherwise
+ * restore the text that was there before starting the search
+ */
+void QCommandEdit::stopHistorySearch(bool accept)
+{
+    if(!historySearchState_.active_) return;
+
+    if(!accept)
+        setText(historySearchState_.savedText_);
+    historySearchState_.reset();
+    historyState_.reset();
+    setToolTipAtCursor("");
+
+    // the match flags take a byte per distinct entry: widgets sharing a
+    // history keep them only while searching (if a search is running, they
+    // are freed when it is done)
+    if(historySearch_)
+        historySearch_->reset();
+}
+
+/*
+ * Length of the longest common prefix of strs, ignoring the first offset
+ * characters of every string. Compares four UTF-16 code units at a time and
+ * does not allocate.
+ */
+static int longestCommonPrefixLength(const QStringList &strs, int offset)
+{
+    if(strs.isEmpty()) return 0;
+    const QChar *first = strs.first().constData() + offset;
+    int len = strs.first().length() - offset;
+    for(int i = 1; i < strs.size() && len > 0; i++)
     {
-        for(int j = 0; j < std::min(result.length(), strs[i].length()); j++)
+        const QChar *s = strs.at(i).constData() + offset;
+        len = std::min(len, strs.at(i).length() - offset);
+        int j = 0;
+        for(; j + 4 <= len; j += 4)
         {
-            if(j == strs[i].length())
-            {
-                result = strs[i];
-                break;
-            }
-            if(result.at(j) != strs[i].at(j))
-            {
-                result = result.left(j);
-                break;
-            }
+            quint64 a, b;
+            memcpy(&a, first + j, sizeof(a));
+            memcpy(&b, s + j, sizeof(b));
+            if(a != b) break;
         }
+        while(j < len && first[j] == s[j])
+            j++;
+        len = j;
     }
-    return result;
+    return std::max(len, 0);
 }
 
 /*!
@@ -252,48 +680,96 @@ static QString longestCommonPrefix(const QStringList &strs)
  * After inserting the new text, the cursor poisition will be at end of new text.
  * New text will be selected or selection will be empty depending on the
  * selected parameter.
+ *
+ * The text is spliced in with QLineEdit::insert(), so the rest of the text
+ * is not rebuilt, and the edit can be undone. Like a programmatic change,
+ * it emits textChanged() but not textEdited().
  */
 void QCommandEdit::insertTextAtCursor(const QString &txt, bool selected)
 {
     int c = hasSelectedText() ? selectionStart() : cursorPosition();
     QString oldText = text();
-    QString before = oldText.left(c);
-    QString after = oldText.mid(c + selectedText().length());
-    QString newText = before + txt + after;
-    setText(newText);
-    setCursorPosition(before.length() + txt.length());
-    if(selected)
-        setSelection(before.length(), txt.length());
+    int oldPos = cursorPosition();
+    int oldSelStart = selectionStart();
+    QString oldSelection = selectedText();
+
+    // QLineEdit::insert() emits textEdited(), as if the user typed the text;
+    // the other signals are emitted below, only for what actually changed
+    bool oldBlockSignals = blockSignals(true);
+    insert(txt);
+    if(selected && !txt.isEmpty())
+        setSelection(c, txt.length());
+    blockSignals(oldBlockSignals);
+
+    if(signalsBlocked())
+        return;
+    QString newText = text();
+    if(newText != oldText)
+        Q_EMIT textChanged(newText);
+    if(cursorPosition() != oldPos)
+        Q_EMIT cursorPositionChanged(oldPos, cursorPosition());
+    if(selectionStart() != oldSelStart || selectedText() != oldSelection)
+        Q_EMIT selectionChanged();
 }
 
 /*!
  * \brief Set the list of completions for the current cursor position
  * \param completion The list of completions
+ *
+ * When answering the pending completion request (see askCompletion()), the
+ * completion is applied right away. Otherwise the list is kept, and cycled
+ * thru by the next Tab; with setDiscardStaleCompletions(true), it is instead
+ * discarded, e.g. for hosts answering asynchronously, whose answers may
+ * arrive after the text or the cursor position have changed.
  */
 void QCommandEdit::setCompletion(const QStringList &completion)
+{
+    bool answer = completionState_.requested_
+            && text() == completionState_.requestText_
+            && cursorPosition() == completionState_.requestPos_;
+    if(!answer)
+    {
+        completionState_.requested_ = false;
+        if(!discardStaleCompletions_)
+            applyCompletion(completion, 0);
+        return;
+    }
+
+    qint64 start = profiler_ ? profiler_->now() : 0;
+
+    if(completionCacheEnabled_)
+    {
+        completionCache_.valid_ = true;
+        completionCacheKey(text(), cursorPosition(), completionCache_.key_);
+        completionCache_.completion_ = completion;
+    }
+
+    applyCompletion(completion, 0);
+
+    if(profiler_)
+        recordLatency(QCommandEditProfiler::Completion, start);
+}
+
+/*
+ * Candidates are kept as given (sharing their data with the caller), and the
+ * first trim characters of every candidate are ignored; accepting the common
+ * prefix only moves trim forward.
+ */
+void QCommandEdit::applyCompletion(const QStringList &completion, int trim)
 {
     completionState_.completion_ = completion;
+    completionState_.trim_ = trim;
 
     if(autoAcceptLongestCommonCompletionPrefix_)
     {
-        QString lcp = longestCommonPrefix(completion);
-        if(!lcp.isEmpty() && completionState_.requested_)
+        int lcp = longestCommonPrefixLength(completion, trim);
+        if(lcp > 0 && completionState_.requested_)
         {
-            QStringList completionTrimmed;
-            for(const QString &s : completion)
-                completionTrimmed << s.mid(lcp.length());
-
             bool oldBlockSignals = blockSignals(true);
-            insertTextAtCursor(lcp, false);
+            insertTextAtCursor(completion.first().mid(trim, lcp), false);
             blockSignals(oldBlockSignals);
 
-            completionState_.completion_ = completionTrimmed;
-
-            if(completionTrimmed.isEmpty())
-            {
-                completionState_.reset();
-                return;
-            }
+            completionState_.trim_ += lcp;
         }
     }
 
@@ -301,6 +777,90 @@ void QCommandEdit::setCompletion(const QStringList &completion)
         navigateCompletion(1);
 }
 
+/*!
+ * \brief Set the list of completions for a specific completion request
+ * \param requestId The id of the request, see completionRequestId()
+ * \param completion The list of completions
+ *
+ * The completions are discarded if the request is not the pending one, or
+ * if the text or the cursor position have changed since the request.
+ */
+void QCommandEdit::setCompletionForRequest(int requestId, const QStringList &completion)
+{
+    if(requestId != completionState_.requestId_
+            || !completionState_.requested_
+            || text() != completionState_.requestText_
+            || cursorPosition() != completionState_.requestPos_)
+        return;
+    setCompletion(completion);
+}
+
+/*!
+ * \brief Discard completions which do not answer the pending request
+ * \param discard If true, setCompletion() ignores lists given when no
+ * completion request is pending, or after the text or the cursor position
+ * have changed since the request; if false (the default), such lists are
+ * kept for the next Tab, as completions given in advance
+ */
+void QCommandEdit::setDiscardStaleCompletions(bool discard)
+{
+    discardStaleCompletions_ = discard;
+}
+
+/*!
+ * \brief Enable latency measurements
+ * \param profiler The profiler where durations are recorded, or null for
+ * disabling measurements (the default)
+ *
+ * Durations of key press handling, text edit handling, history searches,
+ * setCompletion() and painting, as well as the time from a key press with a
+ * visible effect to the end of the next paint, are recorded in the profiler and reported with the
+ * latencyMeasured() signal.
+ */
+void QCommandEdit::setProfiler(QSharedPointer<QCommandEditProfiler> profiler)
+{
+    profiler_ = profiler;
+    keyPressTime_ = -1;
+    keyPressStart_ = -1;
+}
+
+QSharedPointer<QCommandEditProfiler> QCommandEdit::profiler() const
+{
+    return profiler_;
+}
+
+void QCommandEdit::recordLatency(QCommandEditProfiler::Stage stage, qint64 start)
+{
+    qint64 duration = profiler_->now() - start;
+    profiler_->record(stage, start, duration);
+    Q_EMIT latencyMeasured(stage, duration);
+}
+
+/*!
+ * \brief Enable or disable the completion cache
+ * \param enable If true (the default), the last completion result is reused
+ * when completing a token which extends the previously completed token
+ *
+ * For example, after completing "im" to ["port", "plode"], completing "imp"
+ * gives ["ort", "lode"], and completing "impo" gives ["rt"], without asking
+ * for completions again. The cache must be invalidated with
+ * invalidateCompletionCache() when the set of possible completions changes.
+ */
+void QCommandEdit::setCompletionCacheEnabled(bool enable)
+{
+    completionCacheEnabled_ = enable;
+    invalidateCompletionCache();
+}
+
+/*!
+ * \brief Discard the cached completion result
+ */
+void QCommandEdit::invalidateCompletionCache()
+{
+    completionCache_.valid_ = false;
+    completionCache_.completion_.clear();
+}
+
 /*!
  * \brief Reset the completion state
  */
@@ -348,7 +908,7 @@ void QCommandEdit::navigateCompletion(int delta)
         return;
 
     completionState_.index_ = newIndex;
-    setCurrentCompletion(completionState_.completion_[newIndex]);
+    setCurrentCompletion(completionState_.completion_[newIndex].mid(completionState_.trim_));
 }
 
 /*!
@@ -358,12 +918,10 @@ void QCommandEdit::acceptCompletion()
 {
     if(hasSelectedText())
     {
-        QString currentCompletion = selectedText();
-        cancelCompletion();
-        int c = cursorPosition();
-        QString t = text();
-        setText(t.left(c) + currentCompletion + t.mid(c));
-        setCursorPosition(c + currentCompletion.length());
+        // the completion is already in the text (selected): just keep it
+        int end = selectionStart() + selectedText().length();
+        deselect();
+        setCursorPosition(end);
         completionState_.reset();
         searchMatchingHistoryAndShowGhost();
     }
@@ -416,6 +974,7 @@ void QCommandEdit::moveCursorToEnd()
 
 void QCommandEdit::onReturnPressed()
 {
+    flushTextEdited();
     if(text().isEmpty()) return;
 
     if(hasSelectedText())
@@ -426,6 +985,7 @@ void QCommandEdit::onReturnPressed()
 
 void QCommandEdit::onEscapePressed()
 {
+    flushTextEdited();
     if(text().isEmpty())
         Q_EMIT escape();
     if(hasSelectedText())
@@ -444,21 +1004,122 @@ void QCommandEdit::onDownPressed()
     navigateHistory(1);
 }
 
+void QCommandEdit::onReverseSearchPressed()
+{
+    if(historySearchState_.active_)
+        updateHistorySearch(historySearchState_.id_);
+    else
+        startHistorySearch();
+}
+
 void QCommandEdit::onTabPressed()
 {
+    flushTextEdited();
     if(completionState_.completion_.isEmpty())
     {
         if(completionState_.requested_)
             return;
-        completionState_.requested_ = true;
-        Q_EMIT askCompletion(text(), cursorPosition());
+        requestCompletion();
         return;
     }
     navigateCompletion(1);
 }
 
+void QCommandEdit::requestCompletion()
+{
+    completionState_.requested_ = true;
+    completionState_.requestId_ = ++completionRequestCounter_;
+    completionState_.requestText_ = text();
+    completionState_.requestPos_ = cursorPosition();
+
+    QStringList cached;
+    int trim;
+    if(findCachedCompletion(cached, &trim))
+    {
+        applyCompletion(cached, trim);
+        return;
+    }
+
+    if(!completionProvider_)
+    {
+        Q_EMIT askCompletion(text(), cursorPosition());
+        return;
+    }
+
+    QCommandCompletionProvider::Request request;
+    request.id_ = completionState_.requestId_;
+    request.text_ = completionState_.requestText_;
+    request.cursorPos_ = completionState_.requestPos_;
+    QSharedPointer<QAtomicInt> cancel(new QAtomicInt(0));
+    if(completionState_.cancel_)
+        completionState_.cancel_->storeRelease(1); // (superseded request)
+    completionState_.cancel_ = cancel;
+
+    if(!completionProvider_->isAsynchronous())
+    {
+        setCompletionForRequest(request.id_, completionProvider_->complete(request, *cancel));
+        return;
+    }
+
+    // tasks run in completionPool_, which is waited for before the provider
+    // is replaced and before the widget is destroyed
+    QCommandCompletionProvider *provider = completionProvider_;
+    completionWatcher_->setFuture(QtConcurrent::run(completionPool_, [provider, request, cancel]() {
+        CompletionResult result;
+        result.request_ = request;
+        result.completion_ = provider->complete(request, *cancel);
+        return result;
+    }));
+}
+
+/*
+ * Split the text around the token being completed: text before the token,
+ * part of the token before the cursor, and text after the cursor.
+ */
+void QCommandEdit::completionCacheKey(const QString &txt, int pos, QString key[3]) const
+{
+    int start = pos;
+    QTableCommandTokenizer<> tokenizer;
+    tokenizer.setCommand(txt);
+    QCommandTokenizer::TokenLookup lookup = tokenizer.findToken(pos);
+    if(lookup.kind_ == QCommandTokenizer::TokenLookup::InToken)
+        start = tokenizer.tokenAt(lookup.index_).start_;
+    key[0] = txt.left(start);
+    key[1] = txt.mid(start, pos - start);
+    key[2] = txt.mid(pos);
+}
+
+bool QCommandEdit::findCachedCompletion(QStringList &completion, int *trim) const
+{
+    if(!completionCacheEnabled_ || !completionCache_.valid_)
+        return false;
+
+    QString key[3];
+    completionCacheKey(completionState_.requestText_, completionState_.requestPos_, key);
+    const QString *cachedKey = completionCache_.key_;
+    if(key[0] != cachedKey[0] || key[2] != cachedKey[2] || !key[1].startsWith(cachedKey[1]))
+        return false;
+
+    // the token has been extended by some characters since the cached
+    // request: keep the completions starting with them, and skip them
+    QString extra = key[1].mid(cachedKey[1].length());
+    completion.clear();
+    for(const QString &s : completionCache_.completion_)
+        if(s.startsWith(extra))
+            completion << s;
+    *trim = extra.length();
+    return true;
+}
+
+void QCommandEdit::onCompletionFinished()
+{
+    CompletionResult result = completionWatcher_->result();
+    setCompletionForRequest(result.request_.id_, result.completion_);
+}
+
 void QCommandEdit::onShiftTabPressed()
 {
+    flushTextEdited();
     navigateCompletion(-1);
 }
 
@@ -476,44 +1137,386 @@ void QCommandEdit::onCursorPositionChanged(int old, int now)
 
 void QCommandEdit::onTextEdited()
 {
+    if(inputCoalescingBudget_ < 0)
+        processTextEdited();
+    else if(!textEditedTimer_->isActive())
+        textEditedTimer_->start(inputCoalescingBudget_);
+}
+
+/*!
+ * \brief Do the work deferred by onTextEdited(), if any
+ */
+void QCommandEdit::flushTextEdited()
+{
+    if(!textEditedTimer_->isActive()) return;
+
+    textEditedTimer_->stop();
+    processTextEdited();
+}
+
+void QCommandEdit::processTextEdited()
+{
+    qint64 start = profiler_ ? profiler_->now() : 0;
+
+    QString txt = text();
     resetCompletion();
-    historyState_.prefixFilter_ = text();
+    historyState_.prefixFilter_ = txt;
 
-    if(cursorPosition() == text().length())
+    if(cursorPosition() == txt.length())
         searchMatchingHistoryAndShowGhost();
+
+    Q_EMIT textEditedCoalesced(txt);
+
+    if(profiler_)
+        recordLatency(QCommandEditProfiler::TextEdited, start);
 }
 
 void QCommandEdit::searchMatchingHistoryAndShowGhost()
 {
-    if(!text().isEmpty() && showMatchingHistory_)
+    QString txt = text();
+    if(!txt.isEmpty() && showMatchingHistory_)
     {
-        for(int i = historyState_.history_.length() - 1; i >= 0; --i)
+        // if the most recent match for a prefix of the text also matches the
+        // text, it is the most recent match for the text too:
+        QString match = ghostText_ + ghostSuffix_;
+        if(!ghostText_.isEmpty() && txt.startsWith(ghostText_) && match.startsWith(txt))
         {
-            if(historyState_.history_[i].startsWith(text()))
-            {
-                ghostSuffix_ = historyState_.history_[i].mid(text().length());
-                repaint();
-                return;
-            }
+            setGhost(txt, match.mid(txt.length()));
+            historySearchGeneration_++;
+            return;
         }
+
+        // otherwise search in the background, and show the ghost when done
+        HistorySearchRequest request;
+        request.reverse_ = false;
+        request.text_ = txt;
+        request.fromId_ = -1;
+        request.mode_ = QCommandHistorySearch::Substring;
+        requestHistorySearch(request);
+    }
+    else
+    {
+        historySearchGeneration_++;
     }
 
-    if(!ghostSuffix_.isEmpty())
+    setGhost("", "");
+}
+
+bool QCommandEdit::historySearchKeyPressed(QKeyEvent *event)
+{
+    bool ctrl = event->modifiers() == Qt::ControlModifier;
+    if(event->key() == Qt::Key_R && ctrl)
+    {
+        Q_EMIT reverseSearchPressed();
+        return true;
+    }
+    if(event->key() == Qt::Key_Escape || (event->key() == Qt::Key_G && ctrl))
+    {
+        stopHistorySearch(false);
+        return true;
+    }
+    if(event->key() == Qt::Key_Backspace)
     {
-        ghostSuffix_ = "";
-        repaint();
+        historySearchState_.query_.chop(1);
+        updateHistorySearch(historyModel_->history().idAt(historyModel_->history().count()));
+        return true;
     }
+    QString t = event->text();
+    if(!t.isEmpty() && t.at(0).isPrint() && !(event->modifiers() & (Qt::ControlModifier | Qt::AltModifier | Qt::MetaModifier)))
+    {
+        historySearchState_.query_ += t;
+        // the current match is kept if it still matches:
+        const QCommandHistory &history = historyModel_->history();
+        int fromId = historySearchState_.id_ == -1 ? history.idAt(history.count()) : historySearchState_.id_ + 1;
+        updateHistorySearch(fromId);
+        return true;
+    }
+
+    // any other key accepts the match, and is then processed as usual
+    stopHistorySearch(true);
+    return false;
+}
+
+/*
+ * Search the entries with ids below fromId; ids, unlike positions, still
+ * refer to the same entries after entries are removed or dropped.
+ */
+void QCommandEdit::updateHistorySearch(int fromId)
+{
+    HistorySearchRequest request;
+    request.reverse_ = true;
+    request.text_ = historySearchState_.query_;
+    request.fromId_ = fromId;
+    request.mode_ = historySearchMode_;
+    requestHistorySearch(request);
+}
+
+void QCommandEdit::requestHistorySearch(HistorySearchRequest request)
+{
+    // results of earlier requests will be discarded:
+    request.generation_ = ++historySearchGeneration_;
+
+    if(historySearchWatcher_->isRunning())
+    {
+        historySearchCancel_.storeRelease(1);
+        historySearchPending_ = true;
+        historySearchPendingRequest_ = request;
+    }
+    else
+    {
+        launchHistorySearch(request);
+    }
+}
+
+void QCommandEdit::launchHistorySearch(const HistorySearchRequest &request)
+{
+    // (one search at a time: the previous one has handed its state back)
+    Q_ASSERT(historySearch_);
+
+    historySearchCancel_.storeRelease(0);
+    QSharedPointer<QCommandEditProfiler> profiler = profiler_;
+    const QAtomicInt *cancel = &historySearchCancel_;
+
+    // searches run on a snapshot (which shares the prefix index), so that
+    // the history can be modified meanwhile
+    QSharedPointer<const QCommandHistory> snapshot = historyModel_->snapshot();
+
+    // the search state belongs to the search until it is done, and is then
+    // handed back with the result (see onHistorySearchFinished())
+    QSharedPointer<QCommandHistorySearch> search;
+    search.swap(historySearch_);
+    QCommandHistory::Cursor ghostCursor = historyState_.ghostCursor_;
+
+    historySearchWatcher_->setFuture(QtConcurrent::run(historySearchPool_, [request, snapshot, search, ghostCursor, cancel, profiler]() {
+        QCommandEditProfiler::Scope scope(profiler.data(), QCommandEditProfiler::HistorySearch);
+        HistorySearchResult result = runHistorySearch(request, snapshot.data(), search, ghostCursor, cancel);
+        result.duration_ = scope.elapsed();
+        return result;
+    }));
+}
+
+/*
+ * Runs in the search thread; it only uses its arguments.
+ */
+QCommandEdit::HistorySearchResult QCommandEdit::runHistorySearch(const HistorySearchRequest &request, const QCommandHistory *snapshot,
+        const QSharedPointer<QCommandHistorySearch> &search, const QCommandHistory::Cursor &ghostCursor, const QAtomicInt *cancel)
+{
+    HistorySearchResult result;
+    result.request_ = request;
+    result.duration_ = 0;
+    result.search_ = search;
+    result.ghostCursor_ = ghostCursor;
+    if(request.reverse_)
+        result.index_ = search->search(*snapshot, request.text_, request.mode_, snapshot->lowerBound(request.fromId_), cancel);
+    else
+        result.index_ = snapshot->mostRecentMatch(result.ghostCursor_, request.text_, cancel);
+    result.id_ = result.index_ >= 0 ? snapshot->idAt(result.index_) : -1;
+    if(result.index_ >= 0)
+        result.entry_ = snapshot->at(result.index_);
+    result.cancelled_ = cancel->loadAcquire();
+    if(result.cancelled_)
+        result.entry_ = QString();
+    return result;
+}
+
+/*
+ * Interrupt the running search (e.g. when the history is replaced); it will
+ * be restarted if still relevant.
+ */
+void QCommandEdit::cancelHistorySearch()
+{
+    historySearchCancel_.storeRelease(1);
+}
+
+/*
+ * Search again the entry shown as ghost, which may have been removed from the
+ * history; the ghost stays visible until the search is done.
+ */
+void QCommandEdit::refreshGhost()
+{
+    QString txt = text();
+    if(!showMatchingHistory_ || txt.isEmpty() || ghostText_ != txt)
+        return;
+
+    HistorySearchRequest request;
+    request.reverse_ = false;
+    request.text_ = txt;
+    request.fromId_ = -1;
+    request.mode_ = QCommandHistorySearch::Substring;
+    requestHistorySearch(request);
+}
+
+void QCommandEdit::onHistorySearchFinished()
+{
+    HistorySearchResult result = historySearchWatcher_->result();
+    const HistorySearchRequest &request = result.request_;
+    bool current = request.generation_ == historySearchGeneration_;
+
+    if(!historySearch_)
+    {
+        historySearch_ = result.search_;
+        historyState_.ghostCursor_ = result.ghostCursor_;
+        if(!historySearchState_.active_)
+            historySearch_->reset(); // (see stopHistorySearch())
+    }
+
+    if(profiler_)
+        Q_EMIT latencyMeasured(QCommandEditProfiler::HistorySearch, result.duration_);
+
+    if(historySearchPending_)
+    {
+        historySearchPending_ = false;
+        launchHistorySearch(historySearchPendingRequest_);
+    }
+    else if(current && result.cancelled_)
+    {
+        launchHistorySearch(request);
+    }
+    if(!current || result.cancelled_)
+        return;
+
+    // the history may have changed since the snapshot was taken: search
+    // again if the match has been removed or dropped meanwhile
+    if(result.id_ >= 0 && historyModel_->history().indexOf(result.id_) < 0)
+    {
+        launchHistorySearch(request);
+        return;
+    }
+
+    if(!request.reverse_)
+    {
+        if(text() == request.text_)
+        {
+            if(result.index_ >= 0)
+                setGhost(request.text_, result.entry_.mid(request.text_.length()));
+            else
+                setGhost("", "");
+        }
+        return;
+    }
+
+    if(!historySearchState_.active_ || historySearchState_.query_ != request.text_)
+        return;
+    if(result.index_ >= 0)
+    {
+        historySearchState_.id_ = result.id_;
+        setText(result.entry_);
+        int c = request.mode_ == QCommandHistorySearch::Substring ? result.entry_.indexOf(request.text_) : -1;
+        setCursorPosition(c >= 0 ? c : result.entry_.length());
+    }
+
+    bool failed = result.index_ < 0 && !request.text_.isEmpty();
+    QString prompt = failed ? QString("failed reverse-search") : QString("reverse-search");
+    setToolTipAtCursor(QString("(%1)`%2'").arg(prompt, request.text_));
+}
+
+void QCommandEdit::onHistoryReset()
+{
+    if(historyState_.index_ != -1)
+        clear();
+    historyState_.reset();
+    historyState_.filterValid_ = false;
+
+    // the entries may have been renumbered: the running search is of no use,
+    // and is started again on the new history
+    cancelHistorySearch();
+    if(historySearchState_.active_)
+    {
+        historySearchState_.id_ = -1;
+        updateHistorySearch(historyModel_->history().idAt(historyModel_->history().count()));
+    }
+    else
+    {
+        setGhost("", "");
+        searchMatchingHistoryAndShowGhost();
+    }
+}
+
+void QCommandEdit::onHistoryEntryAppended(const QString &entry, int id)
+{
+    if(historyState_.filterValid_ && entry.startsWith(historyState_.filterPrefix_))
+        historyState_.filterMatches_.append(id);
+
+    // a new entry matching the text is its most recent match; otherwise the
+    // ghost is unchanged
+    QString txt = text();
+    if(showMatchingHistory_ && !txt.isEmpty() && !historySearchState_.active_
+            && !textEditedTimer_->isActive() && cursorPosition() == txt.length()
+            && entry.startsWith(txt))
+    {
+        historySearchGeneration_++;
+        setGhost(txt, entry.mid(txt.length()));
+    }
+}
+
+void QCommandEdit::onHistoryEntriesDropped(int count)
+{
+    if(count <= 0)
+        return;
+
+    refreshGhost();
+
+    if(historyState_.index_ == -1)
+        return;
+
+    historyState_.index_ = historyModel_->history().indexOf(historyState_.id_);
+    if(historyState_.index_ < 0)
+        clear(); // the entry being edited is gone
+}
+
+void QCommandEdit::onHistoryEntryRemoved(int id)
+{
+    const QCommandHistory &history = historyModel_->history();
+
+    if(historyState_.filterValid_)
+    {
+        QVector<int> &matches = historyState_.filterMatches_;
+        QVector<int>::iterator it = std::lower_bound(matches.begin(), matches.end(), id);
+        if(it != matches.end() && *it == id)
+        {
+            if(it - matches.begin() < historyState_.filterPos_)
+                historyState_.filterPos_--;
+            matches.erase(it);
+        }
+    }
+
+    // entries after the removed one move up by one position
+    if(historyState_.index_ != -1)
+    {
+        if(historyState_.id_ == id)
+            clear(); // the entry being edited is gone
+        else
+            historyState_.index_ = history.indexOf(historyState_.id_);
+    }
+
+    refreshGhost();
 }
 
 void QCommandEdit::HistoryState::reset()
 {
     index_ = -1;
+    id_ = -1;
     prefixFilter_ = "";
 }
 
+void QCommandEdit::HistorySearchState::reset()
+{
+    active_ = false;
+    query_ = "";
+    savedText_ = "";
+    id_ = -1;
+}
+
 void QCommandEdit::CompletionState::reset()
 {
     completion_.clear();
+    trim_ = 0;
     requested_ = false;
     index_ = -1;
+    requestId_ = -1;
+    requestText_ = "";
+    requestPos_ = -1;
+    if(cancel_)
+        cancel_->storeRelease(1);
+    cancel_.clear();
 }
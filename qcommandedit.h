@@ -17,17 +17,47 @@
 #ifndef QCOMMANDEDIT_H
 #define QCOMMANDEDIT_H
 
+#include <QAtomicInt>
+#include <QFutureWatcher>
 #include <QLineEdit>
+#include <QSharedPointer>
 #include <QStringList>
+#include <QTextLayout>
+
+#include "qcommandcompletionprovider.h"
+#include "qcommandeditprofiler.h"
+#include "qcommandhistory.h"
+#include "qcommandhistorysearch.h"
+
+class QCommandHistoryJournal;
+class QCommandHistoryModel;
+class QThreadPool;
+class QTimer;
 
 class QCommandEdit : public QLineEdit
 {
     Q_OBJECT
 public:
     explicit QCommandEdit(QWidget *parent = nullptr);
+    ~QCommandEdit();
 
     void setShowMatchingHistory(bool show);
     void setAutoAcceptLongestCommonCompletionPrefix(bool accept);
+    void setInputCoalescing(int budget);
+
+    const QCommandHistory & history() const;
+    void setHistoryModel(QCommandHistoryModel *model);
+    QCommandHistoryModel * historyModel() const;
+    bool loadHistory(const QString &fileName);
+    bool saveHistory(const QString &fileName) const;
+    void setHistoryJournal(QCommandHistoryJournal *journal);
+    void setHistorySearchMode(QCommandHistorySearch::Mode mode);
+    void setCompletionProvider(QCommandCompletionProvider *provider);
+    int completionRequestId() const;
+    void setCompletionCacheEnabled(bool enable);
+    void setDiscardStaleCompletions(bool discard);
+    void setProfiler(QSharedPointer<QCommandEditProfiler> profiler);
+    QSharedPointer<QCommandEditProfiler> profiler() const;
 
     void paintEvent(QPaintEvent *event);
     void keyPressEvent(QKeyEvent *event);
@@ -36,11 +66,18 @@ public:
 public Q_SLOTS:
     void clear();
     void setHistory(const QStringList &history);
+    void appendHistory(const QString &entry);
+    void removeHistory(int index);
+    void setHistoryCapacity(int capacity);
     void navigateHistory(int delta);
     void setHistoryIndex(int index);
+    void startHistorySearch();
+    void stopHistorySearch(bool accept);
     void insertTextAtCursor(const QString &txt, bool selected);
     void setCompletion(const QStringList &completion);
+    void setCompletionForRequest(int requestId, const QStringList &completion);
     void resetCompletion();
+    void invalidateCompletionCache();
     void setCurrentCompletion(const QString &s);
     void navigateCompletion(int delta);
     void acceptCompletion();
@@ -55,44 +92,176 @@ Q_SIGNALS:
     void escapePressed();
     void upPressed();
     void downPressed();
+    void reverseSearchPressed();
     void tabPressed();
     void shiftTabPressed();
+    void textEditedCoalesced(const QString &text);
+    void latencyMeasured(QCommandEditProfiler::Stage stage, qint64 nsecs);
 
 private Q_SLOTS:
     void onReturnPressed();
     void onEscapePressed();
     void onUpPressed();
     void onDownPressed();
+    void onReverseSearchPressed();
     void onTabPressed();
     void onShiftTabPressed();
     void onSelectionChanged();
     void onCursorPositionChanged(int old, int now);
     void onTextEdited();
+    void processTextEdited();
+    void onHistorySearchFinished();
+    void onCompletionFinished();
+    void onHistoryReset();
+    void onHistoryEntryAppended(const QString &entry, int id);
+    void onHistoryEntriesDropped(int count);
+    void onHistoryEntryRemoved(int id);
 
 private:
     struct HistoryState
     {
-        QStringList history_;
         int index_;
+        int id_; // id of the entry at index_
         QString prefixFilter_;
+        QCommandHistory::Cursor ghostCursor_;
+
+        // ids of history entries matching filterPrefix_, built once per prefix
+        QVector<int> filterMatches_;
+        QString filterPrefix_;
+        bool filterValid_;
+        int filterPos_;
 
         void reset();
     } historyState_;
 
+    struct HistorySearchState
+    {
+        bool active_;
+        QString query_;
+        QString savedText_;
+        int id_; // id of the current match, or -1
+
+        void reset();
+    } historySearchState_;
+
+    // history searches run in a background thread:
+    struct HistorySearchRequest
+    {
+        bool reverse_; // Ctrl+R search (true) or ghost prefix search (false)
+        QString text_;
+        int fromId_; // only entries with lower ids are searched (Ctrl+R)
+        QCommandHistorySearch::Mode mode_;
+        int generation_;
+    };
+
+    struct HistorySearchResult
+    {
+        HistorySearchRequest request_;
+        bool cancelled_;
+        int index_;
+        int id_;
+        QString entry_;
+        qint64 duration_;
+
+        // the search state, handed back (see launchHistorySearch())
+        QSharedPointer<QCommandHistorySearch> search_;
+        QCommandHistory::Cursor ghostCursor_;
+    };
+
     struct CompletionState
     {
         QStringList completion_;
+        int trim_; // characters already inserted, common to all completions
         bool requested_;
         int index_;
 
+        // the pending request, and the editor state it was made for:
+        int requestId_;
+        QString requestText_;
+        int requestPos_;
+        QSharedPointer<QAtomicInt> cancel_;
+
         void reset();
     } completionState_;
 
+    // the last completion result received, and the editor state it was for
+    // (see completionCacheKey()):
+    struct CompletionCache
+    {
+        bool valid_;
+        QString key_[3];
+        QStringList completion_;
+    } completionCache_;
+
+    // what a key press can change on screen (see endKeyPress())
+    struct KeyPressState
+    {
+        QString text_;
+        int cursor_;
+        int selectionStart_;
+        int selectionLength_;
+        QString ghostSuffix_;
+        bool searchActive_;
+        QString searchQuery_;
+
+        bool operator==(const KeyPressState &o) const;
+    } keyPressState_;
+
+    struct CompletionResult
+    {
+        QCommandCompletionProvider::Request request_;
+        QStringList completion_;
+    };
+
+    void handleKeyPress(QKeyEvent *event);
+    KeyPressState currentKeyPressState() const;
+    void endKeyPress();
+    void flushTextEdited();
+    void paintGhost();
+    void recordLatency(QCommandEditProfiler::Stage stage, qint64 start);
     void searchMatchingHistoryAndShowGhost();
+    void setGhost(const QString &text, const QString &suffix);
+    bool historySearchKeyPressed(QKeyEvent *event);
+    void updateHistorySearch(int fromId);
+    void requestHistorySearch(HistorySearchRequest request);
+    void launchHistorySearch(const HistorySearchRequest &request);
+    static HistorySearchResult runHistorySearch(const HistorySearchRequest &request, const QCommandHistory *snapshot,
+            const QSharedPointer<QCommandHistorySearch> &search, const QCommandHistory::Cursor &ghostCursor, const QAtomicInt *cancel);
+    void cancelHistorySearch();
+    void refreshGhost();
+    void requestCompletion();
+    void applyCompletion(const QStringList &completion, int trim);
+    void completionCacheKey(const QString &txt, int pos, QString key[3]) const;
+    bool findCachedCompletion(QStringList &completion, int *trim) const;
 
     bool showMatchingHistory_;
     bool autoAcceptLongestCommonCompletionPrefix_;
+    QCommandHistoryModel *historyModel_;
+    QCommandHistoryJournal *historyJournal_;
+    QSharedPointer<QCommandHistorySearch> historySearch_; // null while a search runs
+    QCommandHistorySearch::Mode historySearchMode_;
+
+    QThreadPool *historySearchPool_;
+    QFutureWatcher<HistorySearchResult> *historySearchWatcher_;
+    QAtomicInt historySearchCancel_;
+    int historySearchGeneration_;
+    bool historySearchPending_;
+    HistorySearchRequest historySearchPendingRequest_;
+    QCommandCompletionProvider *completionProvider_;
+    QThreadPool *completionPool_; // where providers run, waited for on teardown
+    QFutureWatcher<CompletionResult> *completionWatcher_;
+    int completionRequestCounter_;
+    bool completionCacheEnabled_;
+    bool discardStaleCompletions_;
+    int inputCoalescingBudget_; // -1 if edits are processed immediately
+    QTimer *textEditedTimer_; // pending edits, when coalescing
     QString ghostSuffix_; // for showing matching history
+    QString ghostText_; // the text ghostSuffix_ was searched for
+    QTextLayout ghostLayout_;
+    QRect ghostRect_; // where the ghost was last drawn
+    QSharedPointer<QCommandEditProfiler> profiler_;
+    qint64 keyPressTime_; // first key press with visible effect not painted yet, or -1
+    qint64 keyPressStart_; // key press being handled, or -1
 };
 
 #endif // QCOMMANDEDIT_H
@@ -0,0 +1,45 @@
+# QCommandEdit - a command input widget with history and tab completion
+# Copyright (C) 2018 Federico Ferri
+#
+# The widget and its history, completion and tokenizer classes; included by
+# the demo, the benchmarks and the tools, so that they build the same sources
+
+INCLUDEPATH += $$PWD
+
+SOURCES += \
+    $$PWD/qcommandcompletionindex.cpp \
+    $$PWD/qcommandedit.cpp \
+    $$PWD/qcommandeditprofiler.cpp \
+    $$PWD/qcommandhistory.cpp \
+    $$PWD/qcommandhistoryfile.cpp \
+    $$PWD/qcommandhistoryjournal.cpp \
+    $$PWD/qcommandhistorymodel.cpp \
+    $$PWD/qcommandhistoryqueue.cpp \
+    $$PWD/qcommandhistorysearch.cpp \
+    $$PWD/qcommandhistorystorage.cpp \
+    $$PWD/qcommandhistoryindex.cpp \
+    $$PWD/qcommandtokenizer.cpp \
+    $$PWD/qshellcommandtokenizer.cpp
+
+HEADERS += \
+    $$PWD/qcommandcompletionindex.h \
+    $$PWD/qcommandcompletionprovider.h \
+    $$PWD/qcommandedit.h \
+    $$PWD/qcommandedit_p.h \
+    $$PWD/qcommandeditprofiler.h \
+    $$PWD/qcommandhistory.h \
+    $$PWD/qcommandhistoryfile.h \
+    $$PWD/qcommandhistoryjournal.h \
+    $$PWD/qcommandhistorymodel.h \
+    $$PWD/qcommandhistoryqueue.h \
+    $$PWD/qcommandhistorysearch.h \
+    $$PWD/qcommandhistorystorage.h \
+    $$PWD/qcommandhistoryindex.h \
+    $$PWD/qcommandtokenizer.h \
+    $$PWD/qshellcommandtokenizer.h \
+    $$PWD/qtablecommandtokenizer.h
+
+DEFINES += \
+    QT_DISABLE_DEPRECATED_BEFORE=0x060000 \
+    QT_RESTRICTED_CAST_FROM_ASCII \
+    QT_NO_KEYWORDS
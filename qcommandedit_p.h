@@ -0,0 +1,63 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef QCOMMANDEDIT_P_H
+#define QCOMMANDEDIT_P_H
+
+//
+//  W A R N I N G
+//  -------------
+//
+// This file is not part of the QCommandEdit API: it is included by the
+// implementation only, and may change without notice.
+//
+
+// SIMD support, detected at compile time. QCOMMANDEDIT_SSE2 is defined when
+// SSE2 intrinsics can be used unconditionally: SSE2 is part of x86-64, and
+// of x86 builds targeting it (MSVC does not define __SSE2__).
+// QCOMMANDEDIT_AVX2 is defined when AVX2 code can be compiled, in functions
+// marked QCOMMANDEDIT_TARGET_AVX2; it must only run after checking that the
+// CPU has AVX2.
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define QCOMMANDEDIT_SSE2
+#include <emmintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#define QCOMMANDEDIT_AVX2
+#define QCOMMANDEDIT_TARGET_AVX2
+#include <immintrin.h>
+#include <intrin.h>
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define QCOMMANDEDIT_AVX2
+#define QCOMMANDEDIT_TARGET_AVX2 __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+#endif
+
+// The instruction sets the history search may use (see findBytes() in
+// qcommandhistorysearch.cpp): by default the best one the CPU supports;
+// tests lower it to check the other code paths too.
+enum QCommandEditSimd
+{
+    QCommandEditScalar,
+    QCommandEditSse2,
+    QCommandEditAvx2
+};
+
+QCommandEditSimd qCommandEditSimd();
+QCommandEditSimd qCommandEditSetSimd(QCommandEditSimd simd);
+const char * qCommandEditFindBytes(const char *hay, int n, const char *needle, int m);
+
+#endif // QCOMMANDEDIT_P_H
@@ -0,0 +1,233 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "qcommandeditprofiler.h"
+
+#include <QFile>
+#include <QThread>
+#include <QtAlgorithms>
+
+#include <cmath>
+#include <limits>
+
+QCommandEditProfiler::Scope::Scope(QCommandEditProfiler *profiler, Stage stage)
+    : profiler_(profiler),
+      stage_(stage),
+      start_(profiler ? profiler->now() : 0)
+{
+}
+
+QCommandEditProfiler::Scope::~Scope()
+{
+    if(profiler_)
+        profiler_->record(stage_, start_, profiler_->now() - start_);
+}
+
+qint64 QCommandEditProfiler::Scope::elapsed() const
+{
+    return profiler_ ? profiler_->now() - start_ : 0;
+}
+
+/*!
+ * \brief Create a profiler
+ * \param traceCapacity Number of events kept for writeChromeTrace() (0 for
+ * histograms only)
+ */
+QCommandEditProfiler::QCommandEditProfiler(int traceCapacity)
+    : trace_(traceCapacity > 0 ? new TraceEvent[traceCapacity] : nullptr),
+      traceCapacity_(qMax(traceCapacity, 0)),
+      traceNext_(0)
+{
+    clock_.start();
+    reset();
+}
+
+/*!
+ * \brief Current time in nanoseconds, relative to the profiler creation
+ */
+qint64 QCommandEditProfiler::now() const
+{
+    return clock_.nsecsElapsed();
+}
+
+/*!
+ * \brief Record a duration; can be called from any thread
+ * \param stage The stage
+ * \param start Start time (see now())
+ * \param duration Duration in nanoseconds
+ */
+void QCommandEditProfiler::record(Stage stage, qint64 start, qint64 duration)
+{
+    duration = qMax(duration, qint64(0));
+    Histogram &h = histograms_[stage];
+    h.buckets_[bucket(duration)].fetchAndAddRelaxed(1);
+    h.count_.fetchAndAddRelaxed(1);
+    h.total_.fetchAndAddRelaxed(duration);
+    qint64 max = h.max_.loadAcquire();
+    while(duration > max && !h.max_.testAndSetRelaxed(max, duration, max)) {}
+
+    if(traceCapacity_ > 0)
+    {
+        // when the ring wraps while another thread still writes the slot,
+        // the event is dropped
+        TraceEvent &e = trace_[int(traceNext_.fetchAndAddRelaxed(1) % quint64(traceCapacity_))];
+        quint64 seq = e.seq_.loadAcquire();
+        if((seq & 1) == 0 && e.seq_.testAndSetAcquire(seq, seq + 1))
+        {
+            e.start_.storeRelease(start);
+            e.duration_.storeRelease(duration);
+            e.stage_.storeRelease(stage);
+            e.thread_.storeRelease(reinterpret_cast<quintptr>(QThread::currentThreadId()));
+            e.seq_.storeRelease(seq + 2);
+        }
+    }
+}
+
+/*!
+ * \brief Clear all the measurements
+ *
+ * Must not be called while durations are being recorded.
+ */
+void QCommandEditProfiler::reset()
+{
+    for(Histogram &h : histograms_)
+    {
+        for(QAtomicInteger<qint64> &b : h.buckets_)
+            b.storeRelease(0);
+        h.count_.storeRelease(0);
+        h.total_.storeRelease(0);
+        h.max_.storeRelease(0);
+    }
+    for(int i = 0; i < traceCapacity_; i++)
+        trace_[i].seq_.storeRelease(0);
+    traceNext_.storeRelease(0);
+}
+
+qint64 QCommandEditProfiler::count(Stage stage) const
+{
+    return histograms_[stage].count_.loadAcquire();
+}
+
+/*!
+ * \brief Sum of the durations of a stage, in nanoseconds
+ */
+qint64 QCommandEditProfiler::total(Stage stage) const
+{
+    return histograms_[stage].total_.loadAcquire();
+}
+
+/*!
+ * \brief Longest duration of a stage, in nanoseconds
+ */
+qint64 QCommandEditProfiler::maximum(Stage stage) const
+{
+    return histograms_[stage].max_.loadAcquire();
+}
+
+/*!
+ * \brief Duration (in nanoseconds) not exceeded by a fraction p of the
+ * recorded durations of a stage, e.g. 0.99 for the 99th percentile
+ */
+qint64 QCommandEditProfiler::percentile(Stage stage, double p) const
+{
+    const Histogram &h = histograms_[stage];
+    qint64 n = h.count_.loadAcquire();
+    if(n == 0) return 0;
+    qint64 target = qMax(qint64(1), qint64(std::ceil(qBound(0.0, p, 1.0) * double(n))));
+    qint64 seen = 0;
+    for(int b = 0; b < NumBuckets; b++)
+    {
+        seen += h.buckets_[b].loadAcquire();
+        if(seen >= target)
+            return qMin(bucketUpperBound(b), maximum(stage));
+    }
+    return maximum(stage);
+}
+
+/*!
+ * \brief Write the recorded events in Chrome trace event format (JSON)
+ * \return false if the file could not be written, or if the profiler was
+ * created without trace capacity
+ */
+bool QCommandEditProfiler::writeChromeTrace(const QString &fileName) const
+{
+    if(traceCapacity_ == 0) return false;
+
+    QFile f(fileName);
+    if(!f.open(QIODevice::WriteOnly | QIODevice::Truncate))
+        return false;
+
+    QByteArray json("{\"traceEvents\":[");
+    bool first = true;
+    for(int i = 0; i < traceCapacity_; i++)
+    {
+        const TraceEvent &e = trace_[i];
+        quint64 seq = e.seq_.loadAcquire();
+        if(seq == 0 || (seq & 1) != 0) continue;
+        qint64 start = e.start_.loadAcquire();
+        qint64 duration = e.duration_.loadAcquire();
+        int stage = e.stage_.loadAcquire();
+        quintptr thread = e.thread_.loadAcquire();
+        // skip events overwritten while reading
+        if(e.seq_.loadAcquire() != seq) continue;
+        QByteArray event = "{\"name\":\"" + stageName(Stage(stage)).toUtf8()
+                + "\",\"ph\":\"X\",\"pid\":1,\"tid\":" + QByteArray::number(quint64(thread))
+                + ",\"ts\":" + QByteArray::number(double(start) / 1000.0, 'f', 3)
+                + ",\"dur\":" + QByteArray::number(double(duration) / 1000.0, 'f', 3) + "}";
+        if(!first) json += ",\n";
+        json += event;
+        first = false;
+    }
+    json += "],\"displayTimeUnit\":\"ms\"}\n";
+    return f.write(json) == json.size();
+}
+
+QString QCommandEditProfiler::stageName(Stage stage)
+{
+    switch(stage)
+    {
+    case KeyPress: return "keyPressEvent";
+    case TextEdited: return "textEdited";
+    case HistorySearch: return "historySearch";
+    case Completion: return "setCompletion";
+    case Paint: return "paintEvent";
+    case KeyToPaint: return "keyToPaint";
+    default: return "";
+    }
+}
+
+/*
+ * Durations below 8ns have a bucket each; above, every power of two is split
+ * in SubBuckets buckets.
+ */
+int QCommandEditProfiler::bucket(qint64 duration)
+{
+    if(duration < 2 * SubBuckets)
+        return int(duration);
+    int e = 63 - int(qCountLeadingZeroBits(quint64(duration)));
+    int sub = int((duration >> (e - 2)) & (SubBuckets - 1));
+    return (e - 1) * SubBuckets + sub;
+}
+
+qint64 QCommandEditProfiler::bucketUpperBound(int bucket)
+{
+    if(bucket < 2 * SubBuckets)
+        return bucket;
+    int e = bucket / SubBuckets + 1;
+    int sub = bucket % SubBuckets;
+    quint64 upper = (quint64(SubBuckets + sub + 1) << (e - 2)) - 1;
+    return qint64(qMin(upper, quint64(std::numeric_limits<qint64>::max())));
+}
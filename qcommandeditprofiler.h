@@ -0,0 +1,113 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef QCOMMANDEDITPROFILER_H
+#define QCOMMANDEDITPROFILER_H
+
+#include <QAtomicInteger>
+#include <QElapsedTimer>
+#include <QScopedArrayPointer>
+#include <QString>
+
+/*!
+ * \brief Latency measurements of QCommandEdit
+ *
+ * Durations of every stage are counted in fixed-size histograms with
+ * logarithmic buckets (4 per power of two nanoseconds, i.e. within 19% of
+ * the actual value), updated with atomic operations, so stages running in
+ * other threads (history search) record without locking.
+ *
+ * Optionally, the last events are also kept in a ring buffer, to be written
+ * as a Chrome trace (chrome://tracing, Perfetto) with writeChromeTrace().
+ */
+class QCommandEditProfiler
+{
+public:
+    enum Stage
+    {
+        KeyPress,       //!< keyPressEvent()
+        TextEdited,     //!< processing of edited text (ghost, completion reset)
+        HistorySearch,  //!< history search (in the search thread)
+        Completion,     //!< setCompletion()
+        Paint,          //!< paintEvent()
+        KeyToPaint,     //!< from a key press to the end of the next paint
+        NumStages
+    };
+
+    /*!
+     * \brief Measures the scope it lives in
+     */
+    class Scope
+    {
+    public:
+        Scope(QCommandEditProfiler *profiler, Stage stage);
+        ~Scope();
+        qint64 elapsed() const;
+
+    private:
+        QCommandEditProfiler *profiler_;
+        Stage stage_;
+        qint64 start_;
+    };
+
+    explicit QCommandEditProfiler(int traceCapacity = 0);
+
+    qint64 now() const;
+    void record(Stage stage, qint64 start, qint64 duration);
+    void reset();
+
+    qint64 count(Stage stage) const;
+    qint64 total(Stage stage) const;
+    qint64 maximum(Stage stage) const;
+    qint64 percentile(Stage stage, double p) const;
+
+    bool writeChromeTrace(const QString &fileName) const;
+
+    static QString stageName(Stage stage);
+
+private:
+    enum { SubBuckets = 4, NumBuckets = 64 * SubBuckets };
+
+    struct Histogram
+    {
+        QAtomicInteger<qint64> buckets_[NumBuckets];
+        QAtomicInteger<qint64> count_;
+        QAtomicInteger<qint64> total_;
+        QAtomicInteger<qint64> max_;
+    };
+
+    // a slot of the trace ring; seq_ is odd while a writer owns the slot,
+    // and 0 if it was never written
+    struct TraceEvent
+    {
+        QAtomicInteger<quint64> seq_;
+        QAtomicInteger<qint64> start_;
+        QAtomicInteger<qint64> duration_;
+        QAtomicInteger<int> stage_;
+        QAtomicInteger<quintptr> thread_;
+    };
+
+    static int bucket(qint64 duration);
+    static qint64 bucketUpperBound(int bucket);
+
+    QElapsedTimer clock_;
+    Histogram histograms_[NumStages];
+    QScopedArrayPointer<TraceEvent> trace_;
+    int traceCapacity_;
+    QAtomicInteger<quint64> traceNext_;
+};
+
+#endif // QCOMMANDEDITPROFILER_H
@@ -0,0 +1,634 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "qcommandhistory.h"
+#include "qcommandhistoryfile.h"
+
+#include <algorithm>
+#include <cstring>
+
+// revisions are unique across histories (snapshots share them), so that
+// cursors and searches can tell whether ids still refer to the same entries
+static QBasicAtomicInt lastRevision = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+static int nextRevision()
+{
+    return lastRevision.fetchAndAddRelaxed(1) + 1;
+}
+
+namespace {
+
+// the text referenced by the prefix index: entries of the history file, or
+// distinct entries of the in-memory storage (flagged by storageRef); both
+// stay in place as long as the revision, and thus the index, is the same
+static const quint32 storageRef = 0x80000000u;
+
+class IndexText : public QCommandHistoryIndex::TextSource
+{
+public:
+    IndexText(const QCommandHistoryFile *file, const QCommandHistoryStorage &entries)
+        : file_(file),
+          entries_(entries)
+    {
+    }
+
+    const char * text(quint32 ref, int *size, bool *utf8) const
+    {
+        if(ref & storageRef)
+            return entries_.uniqueData(int(ref & ~storageRef), size, utf8);
+        *utf8 = true;
+        return file_->data(int(ref), size);
+    }
+
+private:
+    const QCommandHistoryFile *file_;
+    const QCommandHistoryStorage &entries_;
+};
+
+} // namespace
+
+QCommandHistory::Cursor::Cursor()
+    : scanRevision_(-1),
+      scanFirst_(0),
+      scanEnd_(0),
+      scanMatch_(-1)
+{
+}
+
+QCommandHistory::QCommandHistory()
+    : fileFirst_(0),
+      fileCount_(0),
+      firstId_(0),
+      capacity_(0),
+      revision_(nextRevision()),
+      index_(new IndexData),
+      indexFirstId_(0),
+      indexEndId_(0)
+{
+}
+
+/*!
+ * \brief Replace the history content
+ * \param entries The new history content
+ */
+void QCommandHistory::set(const QStringList &entries)
+{
+    file_.clear();
+    fileFirst_ = fileCount_ = 0;
+    entries_.clear();
+    int first = capacity_ > 0 ? qMax(0, entries.length() - capacity_) : 0;
+    for(int i = first; i < entries.length(); i++)
+        entries_.append(entries[i]);
+    firstId_ = 0;
+    removed_.clear();
+    revision_ = nextRevision();
+    rebuildIndex();
+}
+
+/*!
+ * \brief Replace the history content with the content of a history file
+ * \param fileName The file name
+ * \return true on success; on failure the history is left unchanged
+ *
+ * The file is memory-mapped and its entries are decoded on demand, so this
+ * takes the same time regardless of the size of the file.
+ */
+bool QCommandHistory::load(const QString &fileName)
+{
+    QSharedPointer<QCommandHistoryFile> file(new QCommandHistoryFile);
+    if(!file->open(fileName))
+        return false;
+
+    set(QStringList());
+    file_ = file;
+    fileCount_ = file->count();
+    evict();
+    return true;
+}
+
+/*!
+ * \brief Write the history content to a history file
+ * \param fileName The file name
+ * \return true on success
+ *
+ * Overwriting the file the history was loaded from fails on Windows (see
+ * QCommandHistoryFile::write()).
+ */
+bool QCommandHistory::save(const QString &fileName) const
+{
+    return QCommandHistoryFile::write(fileName, *this);
+}
+
+/*!
+ * \brief Append an entry, dropping the oldest one if capacity is exceeded
+ * \param entry The new entry
+ */
+void QCommandHistory::append(const QString &entry)
+{
+    entries_.append(entry);
+    // (the index is updated in place, unless a snapshot shares it; many
+    // unindexed entries are left to updateIndex(), e.g. in a background
+    // thread)
+    if(index_.constData()->ref.loadAcquire() == 1 && unindexedCount() <= IndexInPlaceLimit)
+        updateIndex();
+    evict();
+}
+
+/*!
+ * \brief Remove an entry
+ * \param index Position of the entry
+ *
+ * The entry is only marked as removed, so ids do not change and the index
+ * stays valid. Once removed entries outnumber the other entries, the storage
+ * is rebuilt without them (if the history was loaded from a history file,
+ * the file entries are then loaded in memory), and the entries renumbered.
+ */
+void QCommandHistory::remove(int index)
+{
+    if(index < 0 || index >= count())
+        return;
+
+    int id = idAt(index);
+    removed_.insert(std::lower_bound(removed_.begin(), removed_.end(), id), id);
+    while(!removed_.isEmpty() && removed_.first() == firstId_)
+        dropFirst();
+    if(removed_.size() > count())
+        purgeRemoved();
+}
+
+void QCommandHistory::clear()
+{
+    set(QStringList());
+}
+
+/*!
+ * \brief Limit the number of entries
+ * \param capacity The maximum number of entries, or 0 for no limit
+ *
+ * When the limit is exceeded, the oldest entries are dropped.
+ */
+void QCommandHistory::setCapacity(int capacity)
+{
+    capacity_ = qMax(0, capacity);
+    evict();
+}
+
+int QCommandHistory::capacity() const
+{
+    return capacity_;
+}
+
+int QCommandHistory::count() const
+{
+    return slotCount() - removed_.size();
+}
+
+QString QCommandHistory::at(int index) const
+{
+    int slot = idAt(index) - firstId_;
+    if(slot < fileCount_)
+        return file_->at(fileFirst_ + slot);
+    return entries_.at(slot - fileCount_);
+}
+
+/*!
+ * \brief Return the id of the oldest entry (i.e. the entry at position 0)
+ */
+int QCommandHistory::firstId() const
+{
+    return firstId_;
+}
+
+/*!
+ * \brief Return the id of the entry at a position
+ * \param index The position, from 0 to count(); count() gives the id the
+ * next appended entry will have
+ */
+int QCommandHistory::idAt(int index) const
+{
+    // the id is firstId_ + index plus the number k of removed ids up to it,
+    // i.e. the first k with removed_[k] - k > firstId_ + index (removed_[k]
+    // - k does not decrease, as removed ids are distinct and sorted)
+    int id = firstId_ + index, k = 0, n = removed_.size();
+    while(k < n)
+    {
+        int mid = (k + n) / 2;
+        if(removed_[mid] - mid <= id)
+            k = mid + 1;
+        else
+            n = mid;
+    }
+    return id + k;
+}
+
+/*!
+ * \brief Return the position of the entry with the given id
+ * \param id The id
+ * \return The position, or -1 if the entry has been removed or dropped
+ */
+int QCommandHistory::indexOf(int id) const
+{
+    if(id < firstId_ || id >= firstId_ + slotCount() || isRemoved(id))
+        return -1;
+    return lowerBound(id);
+}
+
+/*!
+ * \brief Return the position of the first entry with an id not below id
+ * \param id The id, which may be of a removed or dropped entry
+ * \return The position, or count() if all the entries have lower ids
+ *
+ * The entries at positions below it are the ones with ids below id.
+ */
+int QCommandHistory::lowerBound(int id) const
+{
+    if(id <= firstId_)
+        return 0;
+    if(id >= firstId_ + slotCount())
+        return count();
+    return id - firstId_ - int(std::lower_bound(removed_.cbegin(), removed_.cend(), id) - removed_.cbegin());
+}
+
+/*!
+ * \brief Return the number of entries read from the history file
+ *
+ * These are the oldest entries (positions 0 to mappedCount() - 1).
+ */
+int QCommandHistory::mappedCount() const
+{
+    return fileCount_;
+}
+
+/*!
+ * \brief Return the revision of the entry ids
+ *
+ * The revision changes when the entries are renumbered (by set(), load(),
+ * or remove() once removed entries outnumber the others) or their storage is
+ * rebuilt; otherwise an id always refers to the same entry. Revisions are
+ * unique: two histories have the same revision only if one is a snapshot of
+ * the other (or both are snapshots of the same history).
+ */
+int QCommandHistory::revision() const
+{
+    return revision_;
+}
+
+/*!
+ * \brief Return the number of entries not in the prefix index yet
+ *
+ * These are the most recent entries; prefix searches scan them one at a
+ * time. See updateIndex().
+ */
+int QCommandHistory::unindexedCount() const
+{
+    return firstId_ + slotCount() - unindexedFirstId();
+}
+
+/*!
+ * \brief Return the memory used by the history, in bytes
+ *
+ * This is the memory used by the entries kept in memory and by the prefix
+ * index (see indexMemoryUsage()); it does not include the mapped history
+ * file.
+ */
+qint64 QCommandHistory::memoryUsage() const
+{
+    return entries_.memoryUsage() + removed_.capacity() * qint64(sizeof(int)) + indexMemoryUsage();
+}
+
+/*!
+ * \brief Return the memory used by the prefix index, in bytes
+ *
+ * After set() or load(), the index is empty until updateIndex() is called
+ * (QCommandHistoryModel does it in a background thread). The index may be
+ * shared with snapshots.
+ */
+qint64 QCommandHistory::indexMemoryUsage() const
+{
+    return index_->index_.memoryUsage();
+}
+
+/*!
+ * \brief Return a copy of the history which shares the entries and the index
+ *
+ * The copy is cheap (see QCommandHistoryStorage) and is not affected by later
+ * changes to this history, so it can be read (and searched by prefix) from
+ * another thread while this history is modified. While the copy exists,
+ * appends to this history leave the new entries out of the shared index.
+ */
+QCommandHistory QCommandHistory::snapshot() const
+{
+    QCommandHistory copy;
+    copy.file_ = file_;
+    copy.fileFirst_ = fileFirst_;
+    copy.fileCount_ = fileCount_;
+    copy.entries_ = entries_;
+    copy.firstId_ = firstId_;
+    copy.removed_ = removed_;
+    copy.capacity_ = capacity_;
+    copy.revision_ = revision_;
+    copy.index_ = index_;
+    copy.indexFirstId_ = indexFirstId_;
+    copy.indexEndId_ = indexEndId_;
+    return copy;
+}
+
+/*!
+ * \brief Add the entries not indexed yet to the prefix index
+ * \param cancel If not null, this is abandoned when it becomes non-zero
+ * \return false if cancelled (the entries indexed so far stay indexed)
+ *
+ * If the index is shared with snapshots, it is copied first. Entries of the
+ * history file are decoded for indexing them, so this takes time
+ * proportional to the number of unindexed entries, and is usually done in a
+ * background thread, on a snapshot (see adoptIndex()).
+ */
+bool QCommandHistory::updateIndex(const QAtomicInt *cancel)
+{
+    int first = unindexedFirstId();
+    int end = firstId_ + slotCount();
+    if(first == end)
+        return true;
+
+    QCommandHistoryIndex &index = index_->index_;
+    IndexText text(file_.data(), entries_);
+    for(indexEndId_ = first; indexEndId_ < end; indexEndId_++)
+    {
+        if(cancel && indexEndId_ % 4096 == 0 && cancel->loadAcquire())
+            return false;
+        if(isRemoved(indexEndId_))
+            continue;
+        int i = indexEndId_ - firstId_;
+        quint32 ref = i < fileCount_ ? quint32(fileFirst_ + i) : storageRef | quint32(entries_.uniqueAt(i - fileCount_));
+        index.insert(ref, indexEndId_, text);
+    }
+    return true;
+}
+
+/*!
+ * \brief Take the prefix index of a snapshot, if it indexes more entries
+ * \param other A snapshot of this history, whose index was updated
+ * \return true if the index was taken
+ *
+ * This lets another thread update the index, on a snapshot, while this
+ * history is used and modified; entries appended meanwhile stay unindexed.
+ * The index is not taken if the entries have been renumbered since the
+ * snapshot was taken (see revision()).
+ */
+bool QCommandHistory::adoptIndex(const QCommandHistory &other)
+{
+    if(other.revision_ != revision_ || other.indexEndId_ <= unindexedFirstId())
+        return false;
+
+    index_ = other.index_;
+    indexFirstId_ = other.indexFirstId_;
+    indexEndId_ = other.indexEndId_;
+    return true;
+}
+
+/*!
+ * \brief Find the most recent entry starting with the given prefix
+ * \param cursor A cursor used to narrow the search incrementally
+ * \param prefix The prefix
+ * \param cancel If not null, the search is abandoned when this becomes non-zero
+ * \return The position of the entry, or -1 if there is no match
+ *
+ * The entries not indexed yet (see unindexedCount()) are scanned from the
+ * most recent one, up to the first match; the cursor remembers that match,
+ * so that extending the prefix resumes the scan from there. If none of them
+ * matches, the other entries are looked up in the prefix index.
+ *
+ * This does not modify the history, so it can be called on a snapshot from
+ * any thread.
+ */
+int QCommandHistory::mostRecentMatch(Cursor &cursor, const QString &prefix, const QAtomicInt *cancel) const
+{
+    QByteArray utf8 = prefix.toUtf8();
+    int id = mostRecentUnindexedMatch(cursor, prefix, utf8, cancel);
+    if(id >= 0)
+        return indexOf(id);
+    if(cancel && cancel->loadAcquire())
+        return -1;
+
+    const QCommandHistoryIndex &index = index_->index_;
+    index.seek(cursor.index_, utf8, IndexText(file_.data(), entries_));
+    id = index.mostRecent(cursor.index_);
+    if(id >= firstId_ && isRemoved(id))
+    {
+        // (the most recent match has been removed: look at the others)
+        QVector<int> ids = index.matches(cursor.index_);
+        for(id = -1; !ids.isEmpty() && id < 0; ids.removeLast())
+            if(!isRemoved(ids.last()))
+                id = ids.last();
+    }
+    return id >= firstId_ ? indexOf(id) : -1;
+}
+
+/*!
+ * \brief Return the ids of the entries starting with the given prefix
+ * \param prefix The prefix
+ * \return The ids, in increasing order
+ */
+QVector<int> QCommandHistory::matchingIds(const QString &prefix) const
+{
+    QByteArray utf8 = prefix.toUtf8();
+    const QCommandHistoryIndex &index = index_->index_;
+    QCommandHistoryIndex::Cursor cursor;
+    index.seek(cursor, utf8, IndexText(file_.data(), entries_));
+    QVector<int> ids = index.matches(cursor);
+    // (dropped and removed entries are left in the index)
+    QVector<int>::iterator end = std::remove_if(ids.begin(), ids.end(), [this](int id) {
+        return id < firstId_ || isRemoved(id);
+    });
+    ids.erase(end, ids.end());
+
+    for(int id = unindexedFirstId(); id < firstId_ + slotCount(); id++)
+        if(!isRemoved(id) && startsWith(id - firstId_, prefix, utf8))
+            ids.append(id);
+    return ids;
+}
+
+/*!
+ * \brief Find the most recent entry before a position starting with a prefix
+ * \param prefix The prefix
+ * \param before The position where the search starts (excluded)
+ * \return The position of the entry, or -1 if there is no match
+ *
+ * This looks up the prefix with matchingIds(); for stepping thru many
+ * matches, keep its result instead.
+ */
+int QCommandHistory::previousMatch(const QString &prefix, int before) const
+{
+    if(before <= 0)
+        return -1;
+    QVector<int> ids = matchingIds(prefix);
+    QVector<int>::const_iterator it = std::lower_bound(ids.cbegin(), ids.cend(), idAt(qMin(before, count())));
+    return it == ids.cbegin() ? -1 : indexOf(*(it - 1));
+}
+
+/*!
+ * \brief Find the oldest entry after a position starting with a prefix
+ * \param prefix The prefix
+ * \param after The position where the search starts (excluded)
+ * \return The position of the entry, or -1 if there is no match
+ *
+ * This looks up the prefix with matchingIds(); for stepping thru many
+ * matches, keep its result instead.
+ */
+int QCommandHistory::nextMatch(const QString &prefix, int after) const
+{
+    if(after >= count() - 1)
+        return -1;
+    QVector<int> ids = matchingIds(prefix);
+    QVector<int>::const_iterator it = std::upper_bound(ids.cbegin(), ids.cend(), after < 0 ? firstId_ - 1 : idAt(after));
+    return it == ids.cend() ? -1 : indexOf(*it);
+}
+
+void QCommandHistory::evict()
+{
+    if(capacity_ <= 0 || count() <= capacity_)
+        return;
+
+    // (removed entries do not count, but are dropped too)
+    while(count() > capacity_ || (!removed_.isEmpty() && removed_.first() == firstId_))
+        dropFirst();
+
+    // dropped entries are left in the index, and ignored because their id
+    // is below firstId_; reclaim them once they outnumber live entries
+    if(firstId_ - indexFirstId_ > count())
+    {
+        compact();
+        rebuildIndex();
+    }
+}
+
+void QCommandHistory::dropFirst()
+{
+    if(!removed_.isEmpty() && removed_.first() == firstId_)
+        removed_.removeFirst();
+    if(fileCount_ > 0)
+    {
+        fileFirst_++;
+        fileCount_--;
+    }
+    else
+    {
+        entries_.removeFirst();
+    }
+    firstId_++;
+}
+
+void QCommandHistory::compact()
+{
+    if(entries_.count() == 0)
+        return;
+
+    QCommandHistoryStorage entries;
+    for(int i = 0; i < entries_.count(); i++)
+        entries.append(entries_.at(i));
+    entries_.swap(entries);
+    revision_ = nextRevision();
+}
+
+void QCommandHistory::purgeRemoved()
+{
+    QCommandHistoryStorage entries;
+    for(int i = 0; i < count(); i++)
+        entries.append(at(i));
+    entries_.swap(entries);
+    file_.clear();
+    fileFirst_ = fileCount_ = 0;
+    firstId_ = 0;
+    removed_.clear();
+    revision_ = nextRevision();
+    rebuildIndex();
+}
+
+void QCommandHistory::rebuildIndex()
+{
+    // (a new index, as the current one may be shared with snapshots)
+    index_ = new IndexData;
+    indexFirstId_ = indexEndId_ = firstId_;
+}
+
+int QCommandHistory::slotCount() const
+{
+    // (the entries kept, including the removed ones)
+    return fileCount_ + entries_.count();
+}
+
+bool QCommandHistory::isRemoved(int id) const
+{
+    return !removed_.isEmpty() && std::binary_search(removed_.cbegin(), removed_.cend(), id);
+}
+
+int QCommandHistory::unindexedFirstId() const
+{
+    // (entries dropped before being indexed are skipped)
+    return qMax(indexEndId_, firstId_);
+}
+
+// returns the id of the match, or -1
+int QCommandHistory::mostRecentUnindexedMatch(Cursor &cursor, const QString &prefix, const QByteArray &utf8, const QAtomicInt *cancel) const
+{
+    int first = unindexedFirstId();
+    int end = firstId_ + slotCount();
+
+    // the most recent match for a longer prefix can't be more recent than
+    // the one for the prefix: entries scanned for it are skipped, except
+    // the ones added since
+    bool resume = cursor.scanRevision_ == revision_ && prefix.startsWith(cursor.scanPrefix_)
+            && cursor.scanFirst_ <= first && cursor.scanEnd_ <= end;
+    int stop = resume ? qMax(first, cursor.scanEnd_) : first;
+    int id = end - 1;
+    for(; id >= stop; id--)
+    {
+        if(cancel && id % 4096 == 0 && cancel->loadAcquire())
+            return -1;
+        if(!isRemoved(id) && startsWith(id - firstId_, prefix, utf8))
+            break;
+    }
+    if(id < stop && resume)
+    {
+        for(id = qMin(cursor.scanMatch_, stop - 1); id >= first; id--)
+        {
+            if(cancel && id % 4096 == 0 && cancel->loadAcquire())
+                return -1;
+            if(!isRemoved(id) && startsWith(id - firstId_, prefix, utf8))
+                break;
+        }
+    }
+    if(id < first)
+        id = -1;
+
+    cursor.scanRevision_ = revision_;
+    cursor.scanPrefix_ = prefix;
+    cursor.scanFirst_ = first;
+    cursor.scanEnd_ = end;
+    cursor.scanMatch_ = id;
+    return id;
+}
+
+bool QCommandHistory::startsWith(int slot, const QString &prefix, const QByteArray &utf8) const
+{
+    if(slot >= fileCount_)
+        return entries_.at(slot - fileCount_).startsWith(prefix);
+
+    // UTF-8 preserves prefixes: compare the text without decoding it
+    int size;
+    const char *data = file_->data(fileFirst_ + slot, &size);
+    return size >= utf8.size() && (utf8.isEmpty() || memcmp(data, utf8.constData(), utf8.size()) == 0);
+}
@@ -0,0 +1,147 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef QCOMMANDHISTORY_H
+#define QCOMMANDHISTORY_H
+
+#include <QAtomicInt>
+#include <QSharedData>
+#include <QSharedPointer>
+#include <QStringList>
+#include <QVector>
+
+#include "qcommandhistoryindex.h"
+#include "qcommandhistorystorage.h"
+
+class QCommandHistoryFile;
+
+/*!
+ * \brief Command history with an incrementally maintained prefix index
+ *
+ * Every entry has an id which does not change when entries are appended,
+ * removed, or dropped because of the capacity limit; the entry at position i
+ * has id idAt(i), which is firstId() + i unless entries have been removed.
+ * Removed entries are only marked as such, and skipped by reads and
+ * searches; once they outnumber the other entries, the entries are
+ * renumbered (and the index rebuilt).
+ *
+ * The oldest entries can be backed by a memory-mapped QCommandHistoryFile
+ * (see load()); entries appended afterwards are kept in memory, in a
+ * QCommandHistoryStorage. The entries of the file are decoded only when
+ * read, or when they are indexed.
+ *
+ * The index is shared (copy on write) with snapshots, and is never modified
+ * while shared, so that snapshots can be searched by other threads. The most
+ * recent entries may not be indexed yet (see unindexedCount()): appends
+ * index them only if the index is not shared and they are at most
+ * IndexInPlaceLimit, and set() and load() index nothing. Searches scan these
+ * entries first, one at a time, from the most recent one; updateIndex()
+ * indexes them, and adoptIndex() takes the index built by another thread
+ * for a snapshot (QCommandHistoryModel does both in a background thread).
+ */
+class QCommandHistory
+{
+public:
+    //! Maximum number of unindexed entries which append() indexes
+    enum { IndexInPlaceLimit = 1024 };
+
+    /*!
+     * \brief State of an incremental prefix search (see mostRecentMatch())
+     */
+    struct Cursor
+    {
+        QCommandHistoryIndex::Cursor index_;
+
+        // most recent match (id, or -1) for scanPrefix_ among the unindexed
+        // entries with ids in [scanFirst_, scanEnd_), if scanRevision_ is the
+        // revision of the history:
+        int scanRevision_;
+        QString scanPrefix_;
+        int scanFirst_;
+        int scanEnd_;
+        int scanMatch_;
+
+        Cursor();
+    };
+
+    QCommandHistory();
+
+    void set(const QStringList &entries);
+    bool load(const QString &fileName);
+    bool save(const QString &fileName) const;
+    void append(const QString &entry);
+    void remove(int index);
+    void clear();
+
+    void setCapacity(int capacity);
+    int capacity() const;
+
+    int count() const;
+    QString at(int index) const;
+    int firstId() const;
+    int idAt(int index) const;
+    int indexOf(int id) const;
+    int lowerBound(int id) const;
+    int mappedCount() const;
+    int revision() const;
+    int unindexedCount() const;
+    qint64 memoryUsage() const;
+    qint64 indexMemoryUsage() const;
+    QCommandHistory snapshot() const;
+
+    bool updateIndex(const QAtomicInt *cancel = nullptr);
+    bool adoptIndex(const QCommandHistory &other);
+
+    int mostRecentMatch(Cursor &cursor, const QString &prefix, const QAtomicInt *cancel = nullptr) const;
+    QVector<int> matchingIds(const QString &prefix) const;
+    int previousMatch(const QString &prefix, int before) const;
+    int nextMatch(const QString &prefix, int after) const;
+
+private:
+    friend class QCommandHistoryFile;
+    friend class QCommandHistorySearch;
+
+    void evict();
+    void dropFirst();
+    void compact();
+    void purgeRemoved();
+    void rebuildIndex();
+    int slotCount() const;
+    bool isRemoved(int id) const;
+    int unindexedFirstId() const;
+    int mostRecentUnindexedMatch(Cursor &cursor, const QString &prefix, const QByteArray &utf8, const QAtomicInt *cancel) const;
+    bool startsWith(int slot, const QString &prefix, const QByteArray &utf8) const;
+
+    QSharedPointer<QCommandHistoryFile> file_;
+    int fileFirst_;
+    int fileCount_;
+    QCommandHistoryStorage entries_;
+    int firstId_; // id of the oldest entry kept, which may be removed
+    QVector<int> removed_; // ids of removed entries, sorted, none below firstId_
+    int capacity_;
+    int revision_; // unique, changed when entries are renumbered or storage is rebuilt
+
+    // the index of the entries with ids in [indexFirstId_, indexEndId_)
+    struct IndexData : public QSharedData
+    {
+        QCommandHistoryIndex index_;
+    };
+    QSharedDataPointer<IndexData> index_;
+    int indexFirstId_;
+    int indexEndId_;
+};
+
+#endif // QCOMMANDHISTORY_H
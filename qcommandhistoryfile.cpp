@@ -0,0 +1,266 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "qcommandhistoryfile.h"
+#include "qcommandhistory.h"
+
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QtEndian>
+
+#include <climits>
+#include <cstring>
+
+/*
+ * File layout (all integers are little endian):
+ *
+ *   char    magic[4]               "QCEH"
+ *   quint32 version                1
+ *   quint64 count
+ *   quint64 offsets[count + 1]     relative to the start of data
+ *   char    data[offsets[count]]   UTF-8 text of the entries
+ */
+
+static const char magic[4] = {'Q', 'C', 'E', 'H'};
+static const quint32 version = 1;
+static const qint64 headerSize = 16;
+
+// the length in UTF-8 of a text encoded as UTF-8 or as Latin-1
+static qint64 utf8Size(const char *text, int size, bool utf8)
+{
+    qint64 n = size;
+    if(!utf8)
+        for(int i = 0; i < size; i++)
+            n += uchar(text[i]) >> 7;
+    return n;
+}
+
+// append a text encoded as UTF-8 or as Latin-1, as UTF-8
+static void appendUtf8(QByteArray &chunk, const char *text, int size, bool utf8)
+{
+    if(utf8)
+    {
+        chunk.append(text, size);
+        return;
+    }
+    for(int i = 0; i < size; i++)
+    {
+        uchar c = uchar(text[i]);
+        if(c < 0x80)
+        {
+            chunk += char(c);
+        }
+        else
+        {
+            chunk += char(0xC0 | (c >> 6));
+            chunk += char(0x80 | (c & 0x3F));
+        }
+    }
+}
+
+QCommandHistoryFile::QCommandHistoryFile()
+    : offsets_(nullptr),
+      data_(nullptr),
+      dataSize_(0),
+      count_(0)
+{
+}
+
+QCommandHistoryFile::~QCommandHistoryFile()
+{
+    close();
+}
+
+/*!
+ * \brief Open and map a history file
+ * \param fileName The file name
+ * \return true on success, false if the file can't be mapped or is not valid
+ */
+bool QCommandHistoryFile::open(const QString &fileName)
+{
+    close();
+
+    file_.setFileName(fileName);
+    if(!file_.open(QIODevice::ReadOnly))
+        return false;
+
+    qint64 size = file_.size();
+    const uchar *p = size >= headerSize ? file_.map(0, size) : nullptr;
+    if(p && memcmp(p, magic, 4) == 0 && qFromLittleEndian<quint32>(p + 4) == version)
+    {
+        quint64 count = qFromLittleEndian<quint64>(p + 8);
+        quint64 tableSize = (count + 1) * 8;
+        if(count < INT_MAX && tableSize <= quint64(size - headerSize))
+        {
+            offsets_ = p + headerSize;
+            data_ = reinterpret_cast<const char*>(offsets_ + tableSize);
+            dataSize_ = quint64(size - headerSize) - tableSize;
+            if(qFromLittleEndian<quint64>(offsets_ + count * 8) <= dataSize_)
+            {
+                count_ = int(count);
+                return true;
+            }
+        }
+    }
+
+    close();
+    return false;
+}
+
+void QCommandHistoryFile::close()
+{
+    offsets_ = nullptr;
+    data_ = nullptr;
+    dataSize_ = 0;
+    count_ = 0;
+    file_.close(); // also unmaps
+}
+
+bool QCommandHistoryFile::isOpen() const
+{
+    return file_.isOpen();
+}
+
+int QCommandHistoryFile::count() const
+{
+    return count_;
+}
+
+/*!
+ * \brief Decode an entry
+ * \param index Index of the entry
+ * \return The entry text, or an empty string if the entry is not valid
+ */
+QString QCommandHistoryFile::at(int index) const
+{
+    int size;
+    const char *p = data(index, &size);
+    return QString::fromUtf8(p, size);
+}
+
+/*!
+ * \brief Return the UTF-8 text of an entry, without decoding it
+ * \param index Index of the entry
+ * \param size Set to the length of the text, in bytes
+ * \return The text (not null terminated), or nullptr if the entry is not valid
+ */
+const char * QCommandHistoryFile::data(int index, int *size) const
+{
+    *size = 0;
+    if(index < 0 || index >= count_)
+        return nullptr;
+
+    quint64 begin = qFromLittleEndian<quint64>(offsets_ + index * 8);
+    quint64 end = qFromLittleEndian<quint64>(offsets_ + (index + 1) * 8);
+    if(begin > end || end > dataSize_)
+        return nullptr;
+    *size = int(end - begin);
+    return data_ + begin;
+}
+
+/*!
+ * \brief Write a history file
+ * \param fileName The file name
+ * \param history The history content
+ * \return true on success
+ *
+ * The file is replaced atomically (by renaming a temporary file), so it is
+ * left unchanged on failure. On POSIX systems this also makes it possible to
+ * overwrite a file which is currently mapped, e.g. the file the history was
+ * loaded from: mappings keep the old content. Windows can't replace a mapped
+ * file: false is returned if the history is mapped from fileName, and
+ * writing fails if the file is mapped by another history.
+ *
+ * The file is written in chunks, without building it in memory: a first
+ * pass writes the table of offsets (from the length of each entry), a
+ * second pass the text of the entries. Both read the text as stored (UTF-8
+ * in the mapped file, Latin-1 or UTF-8 in memory), without decoding it.
+ */
+bool QCommandHistoryFile::write(const QString &fileName, const QCommandHistory &history)
+{
+#if defined(Q_OS_WIN)
+    // (the rename would fail, after writing the whole file)
+    if(history.file_ && QFileInfo(history.file_->file_.fileName()) == QFileInfo(fileName))
+        return false;
+#endif
+
+    QSaveFile f(fileName);
+    if(!f.open(QIODevice::WriteOnly))
+        return false;
+
+    const int chunkSize = 65536;
+    int n = history.count();
+    char header[headerSize];
+    memcpy(header, magic, 4);
+    qToLittleEndian<quint32>(version, header + 4);
+    qToLittleEndian<quint64>(quint64(n), header + 8);
+    if(f.write(header, headerSize) != headerSize)
+        return false;
+
+    // the text of the entry at a position, as stored (see at())
+    auto text = [&history](int index, int *size, bool *utf8) -> const char * {
+        int slot = history.idAt(index) - history.firstId_;
+        if(slot >= history.fileCount_)
+        {
+            const QCommandHistoryStorage &entries = history.entries_;
+            return entries.uniqueData(entries.uniqueAt(slot - history.fileCount_), size, utf8);
+        }
+        *utf8 = true;
+        const char *data = history.file_->data(history.fileFirst_ + slot, size);
+        if(!data)
+            *size = 0;
+        return data;
+    };
+
+    QByteArray chunk;
+    chunk.reserve(chunkSize + 8);
+    quint64 offset = 0;
+    for(int i = 0; i <= n; i++)
+    {
+        char bytes[8];
+        qToLittleEndian<quint64>(offset, bytes);
+        chunk.append(bytes, 8);
+        if(i < n)
+        {
+            int size;
+            bool utf8;
+            const char *data = text(i, &size, &utf8);
+            offset += quint64(utf8Size(data, size, utf8));
+        }
+        if(chunk.size() >= chunkSize || i == n)
+        {
+            if(f.write(chunk) != chunk.size())
+                return false;
+            chunk.resize(0);
+        }
+    }
+
+    for(int i = 0; i < n; i++)
+    {
+        int size;
+        bool utf8;
+        const char *data = text(i, &size, &utf8);
+        appendUtf8(chunk, data, size, utf8);
+        if(chunk.size() >= chunkSize || i == n - 1)
+        {
+            if(f.write(chunk) != chunk.size())
+                return false;
+            chunk.resize(0);
+        }
+    }
+
+    return f.commit();
+}
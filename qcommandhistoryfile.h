@@ -0,0 +1,58 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef QCOMMANDHISTORYFILE_H
+#define QCOMMANDHISTORYFILE_H
+
+#include <QFile>
+#include <QString>
+
+class QCommandHistory;
+
+/*!
+ * \brief Read-only, memory-mapped history file
+ *
+ * The file consists of a header, a table of offsets and the UTF-8 data of
+ * the entries. Opening the file only maps it in memory; entries are decoded
+ * when accessed, so opening time does not depend on the number of entries.
+ */
+class QCommandHistoryFile
+{
+public:
+    QCommandHistoryFile();
+    ~QCommandHistoryFile();
+
+    bool open(const QString &fileName);
+    void close();
+    bool isOpen() const;
+
+    int count() const;
+    QString at(int index) const;
+    const char * data(int index, int *size) const;
+
+    static bool write(const QString &fileName, const QCommandHistory &history);
+
+private:
+    Q_DISABLE_COPY(QCommandHistoryFile)
+
+    QFile file_;
+    const uchar *offsets_;
+    const char *data_;
+    quint64 dataSize_;
+    int count_;
+};
+
+#endif // QCOMMANDHISTORYFILE_H
@@ -0,0 +1,247 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "qcommandhistoryindex.h"
+
+#include <QAtomicInt>
+
+#include <algorithm>
+
+// generations are unique across indexes, so that a cursor is never used with
+// an index other than (a copy of) the one it was moved in
+static QBasicAtomicInt lastGeneration = Q_BASIC_ATOMIC_INITIALIZER(0);
+
+// read the UTF-8 byte at a position of an entry, and move past it; positions
+// count two per byte of the entry, so that Latin-1 chars above 0x7F (two
+// bytes in UTF-8) are read one UTF-8 byte at a time, without converting the
+// entry
+static inline char utf8At(const char *text, bool utf8, int &pos)
+{
+    uchar c = uchar(text[pos >> 1]);
+    if(utf8 || c < 0x80)
+    {
+        pos += 2;
+        return char(c);
+    }
+    if(pos & 1)
+    {
+        pos++;
+        return char(0x80 | (c & 0x3F));
+    }
+    pos++;
+    return char(0xC0 | (c >> 6));
+}
+
+QCommandHistoryIndex::Cursor::Cursor()
+    : generation_(-1),
+      node_(0),
+      pos_(0)
+{
+}
+
+bool QCommandHistoryIndex::Cursor::isValid() const
+{
+    return node_ >= 0;
+}
+
+QCommandHistoryIndex::QCommandHistoryIndex()
+    : generation_(0)
+{
+    clear();
+}
+
+void QCommandHistoryIndex::clear()
+{
+    Node root;
+    root.ref_ = 0;
+    root.begin_ = root.end_ = 0;
+    root.first_ = 0;
+    root.last_ = -1;
+    nodes_.clear();
+    nodes_.append(root);
+    generation_ = lastGeneration.fetchAndAddRelaxed(1) + 1;
+}
+
+/*!
+ * \brief Add an entry to the index
+ * \param ref The reference of the entry text in source
+ * \param id The entry id; must be greater than any previously inserted id
+ * \param source The text of the entries; the index references it from now on
+ */
+void QCommandHistoryIndex::insert(quint32 ref, int id, const TextSource &source)
+{
+    int size;
+    bool utf8;
+    const char *text = source.text(ref, &size, &utf8);
+    int n = 0, pos = 0, end = 2 * size;
+    generation_ = lastGeneration.fetchAndAddRelaxed(1) + 1;
+    nodes_[0].last_ = id;
+    while(pos < end)
+    {
+        int next = pos;
+        char c = utf8At(text, utf8, next);
+        int child = findChild(n, c);
+        if(child < 0)
+        {
+            // no edge starting with this byte => add a leaf
+            Node leaf;
+            leaf.ref_ = ref;
+            leaf.begin_ = pos;
+            leaf.end_ = end;
+            leaf.first_ = c;
+            leaf.ids_.append(id);
+            leaf.last_ = id;
+            nodes_.append(leaf);
+            nodes_[n].children_.append(nodes_.size() - 1);
+            return;
+        }
+
+        int labelSize;
+        bool labelUtf8;
+        const char *label = source.text(nodes_[child].ref_, &labelSize, &labelUtf8);
+        int labelPos = nodes_[child].begin_, labelEnd = nodes_[child].end_;
+        utf8At(label, labelUtf8, labelPos);
+        pos = next;
+        while(labelPos < labelEnd && pos < end)
+        {
+            int l = labelPos, e = pos;
+            if(utf8At(label, labelUtf8, l) != utf8At(text, utf8, e))
+                break;
+            labelPos = l;
+            pos = e;
+        }
+
+        if(labelPos < labelEnd)
+        {
+            // entry diverges (or ends) in the middle of the edge => split it
+            Node mid;
+            mid.ref_ = nodes_[child].ref_;
+            mid.begin_ = nodes_[child].begin_;
+            mid.end_ = labelPos;
+            mid.first_ = nodes_[child].first_;
+            mid.children_.append(child);
+            mid.last_ = nodes_[child].last_;
+            nodes_[child].begin_ = labelPos;
+            nodes_[child].first_ = utf8At(label, labelUtf8, labelPos);
+            nodes_.append(mid);
+            int m = nodes_.size() - 1;
+            nodes_[n].children_.replace(nodes_[n].children_.indexOf(child), m);
+            child = m;
+        }
+
+        nodes_[child].last_ = id;
+        n = child;
+    }
+    nodes_[n].ids_.append(id);
+}
+
+/*!
+ * \brief Move a cursor to the given prefix
+ * \param cursor The cursor, as left by a previous call (or default constructed)
+ * \param prefix The prefix to search, encoded as UTF-8
+ * \param source The text of the entries, as given to insert()
+ *
+ * If prefix extends the prefix the cursor was previously moved to, only the
+ * additional bytes are walked (checking that it does extend it costs
+ * O(length of prefix), a plain comparison).
+ */
+void QCommandHistoryIndex::seek(Cursor &cursor, const QByteArray &prefix, const TextSource &source) const
+{
+    if(cursor.generation_ != generation_ || !prefix.startsWith(cursor.prefix_))
+    {
+        cursor = Cursor();
+        cursor.generation_ = generation_;
+    }
+
+    const char *label = nullptr;
+    int labelSize;
+    bool labelUtf8;
+    for(int i = cursor.prefix_.size(); i < prefix.size() && cursor.isValid(); i++)
+    {
+        const Node *n = &nodes_[cursor.node_];
+        if(cursor.pos_ == n->end_)
+        {
+            cursor.node_ = findChild(cursor.node_, prefix.at(i));
+            if(!cursor.isValid())
+                break;
+            n = &nodes_[cursor.node_];
+            label = nullptr;
+            cursor.pos_ = n->begin_;
+        }
+        if(!label)
+            label = source.text(n->ref_, &labelSize, &labelUtf8);
+        if(utf8At(label, labelUtf8, cursor.pos_) != prefix.at(i))
+            cursor.node_ = -1;
+    }
+    cursor.prefix_ = prefix;
+}
+
+/*!
+ * \brief Return the id of the most recent entry starting with the cursor's prefix
+ * \param cursor The cursor
+ * \return The entry id, or -1 if there is no match
+ */
+int QCommandHistoryIndex::mostRecent(const Cursor &cursor) const
+{
+    if(!cursor.isValid()) return -1;
+    return nodes_[cursor.node_].last_;
+}
+
+/*!
+ * \brief Return the ids of all the entries starting with the cursor's prefix
+ * \param cursor The cursor
+ * \return The ids, in increasing order
+ */
+QVector<int> QCommandHistoryIndex::matches(const Cursor &cursor) const
+{
+    QVector<int> result;
+    if(!cursor.isValid()) return result;
+
+    QVector<int> stack;
+    stack.append(cursor.node_);
+    while(!stack.isEmpty())
+    {
+        const Node &n = nodes_[stack.takeLast()];
+        result += n.ids_;
+        stack += n.children_;
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+/*!
+ * \brief Return the memory used by the index, in bytes
+ *
+ * Edge labels reference the text of the entries, so this is only the nodes.
+ */
+qint64 QCommandHistoryIndex::memoryUsage() const
+{
+    qint64 total = sizeof(*this) + nodes_.capacity() * qint64(sizeof(Node));
+    for(const Node &n : nodes_)
+    {
+        total += n.children_.capacity() * qint64(sizeof(int));
+        total += n.ids_.capacity() * qint64(sizeof(int));
+    }
+    return total;
+}
+
+int QCommandHistoryIndex::findChild(int node, char c) const
+{
+    for(int child : nodes_[node].children_)
+        if(nodes_[child].first_ == c)
+            return child;
+    return -1;
+}
@@ -0,0 +1,97 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef QCOMMANDHISTORYINDEX_H
+#define QCOMMANDHISTORYINDEX_H
+
+#include <QByteArray>
+#include <QVector>
+
+/*!
+ * \brief Prefix index over history entries
+ *
+ * A radix tree where every node records the id of the most recent entry
+ * found below it. Ids must be inserted in increasing order (e.g. history
+ * positions). Edge labels are not copies of the text: they reference a range
+ * of an indexed entry, which is read thru a TextSource (the tree is keyed by
+ * the UTF-8 encoding of the entries). A Cursor narrows the search one byte
+ * at a time, so that extending the prefix walks only the new bytes in the
+ * tree, instead of scanning the whole history; seek() still compares the new
+ * prefix with the cursor's one, so a lookup costs O(length of the prefix),
+ * independent of the history size. Modifying the index invalidates cursors,
+ * which are then restarted from scratch on the next seek(); so does using a
+ * cursor with another index.
+ */
+class QCommandHistoryIndex
+{
+public:
+    /*!
+     * \brief The text of the indexed entries
+     *
+     * Entries are referenced by a number chosen by the caller of insert();
+     * their text must not change, nor go away, while the index references
+     * them.
+     */
+    class TextSource
+    {
+    public:
+        virtual ~TextSource() {}
+
+        //! The text of an entry, encoded as UTF-8, or as Latin-1 if utf8 is false
+        virtual const char * text(quint32 ref, int *size, bool *utf8) const = 0;
+    };
+
+    struct Cursor
+    {
+        QByteArray prefix_;
+        int generation_;
+        int node_;
+        int pos_;
+
+        Cursor();
+        bool isValid() const;
+    };
+
+    QCommandHistoryIndex();
+
+    void clear();
+    void insert(quint32 ref, int id, const TextSource &source);
+    void seek(Cursor &cursor, const QByteArray &prefix, const TextSource &source) const;
+    int mostRecent(const Cursor &cursor) const;
+    QVector<int> matches(const Cursor &cursor) const;
+    qint64 memoryUsage() const;
+
+private:
+    struct Node
+    {
+        // the label is the text of entry ref_ in [begin_, end_) (positions
+        // as in utf8At()); first_ is its first byte
+        quint32 ref_;
+        int begin_;
+        int end_;
+        char first_;
+        QVector<int> children_;
+        QVector<int> ids_;
+        int last_;
+    };
+
+    int findChild(int node, char c) const;
+
+    QVector<Node> nodes_;
+    int generation_;
+};
+
+#endif // QCOMMANDHISTORYINDEX_H
@@ -0,0 +1,373 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "qcommandhistoryjournal.h"
+#include "qcommandhistory.h"
+
+#include <QDeadlineTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QSet>
+#include <QThread>
+#include <QWaitCondition>
+#include <QtEndian>
+
+#include <cstring>
+
+#if defined(Q_OS_WIN)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+/*
+ * File layout (all integers are little endian):
+ *
+ *   char    magic[4]               "QCEJ"
+ *   quint32 version                1
+ *
+ * followed by any number of records:
+ *
+ *   quint32 length
+ *   quint32 crc                    CRC-32 of data
+ *   char    data[length]           UTF-8 text of the entry
+ */
+
+static const char magic[4] = {'Q', 'C', 'E', 'J'};
+static const quint32 version = 1;
+static const qint64 headerSize = 8;
+static const qint64 recordHeaderSize = 8;
+
+namespace {
+
+struct CrcTable
+{
+    quint32 table_[256];
+
+    CrcTable()
+    {
+        for(quint32 i = 0; i < 256; i++)
+        {
+            quint32 c = i;
+            for(int k = 0; k < 8; k++)
+                c = c & 1 ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+            table_[i] = c;
+        }
+    }
+};
+
+} // namespace
+
+static quint32 crc32(const char *data, int len)
+{
+    // (initialized once, thread-safely, by the first call from any thread)
+    static const CrcTable crcTable;
+    const quint32 *table = crcTable.table_;
+
+    quint32 crc = 0xFFFFFFFFu;
+    for(int i = 0; i < len; i++)
+        crc = table[(crc ^ uchar(data[i])) & 0xFF] ^ (crc >> 8);
+    return crc ^ 0xFFFFFFFFu;
+}
+
+static bool syncToDisk(QFile &file)
+{
+    if(!file.flush())
+        return false;
+#if defined(Q_OS_WIN)
+    return _commit(file.handle()) == 0;
+#else
+    return fsync(file.handle()) == 0;
+#endif
+}
+
+class QCommandHistoryJournal::Writer : public QThread
+{
+public:
+    QFile file_;
+    QMutex mutex_;
+    QWaitCondition queued_;
+    QWaitCondition written_;
+    QStringList pending_;
+    int batchInterval_;
+    bool busy_;
+    bool stop_;
+
+    Writer() : batchInterval_(0), busy_(false), stop_(false) {}
+
+protected:
+    void run()
+    {
+        QMutexLocker locker(&mutex_);
+        while(1)
+        {
+            while(pending_.isEmpty() && !stop_)
+                queued_.wait(&mutex_);
+            if(pending_.isEmpty())
+                break;
+
+            // let more entries accumulate, to sync only once per batch:
+            QDeadlineTimer deadline(batchInterval_);
+            while(!stop_ && batchInterval_ > 0 && !deadline.hasExpired())
+                queued_.wait(&mutex_, deadline);
+
+            QStringList batch;
+            batch.swap(pending_);
+            busy_ = true;
+            locker.unlock();
+
+            QByteArray records;
+            for(const QString &entry : batch)
+            {
+                QByteArray data = entry.toUtf8();
+                char header[recordHeaderSize];
+                qToLittleEndian<quint32>(data.size(), header);
+                qToLittleEndian<quint32>(crc32(data.constData(), data.size()), header + 4);
+                records.append(header, int(recordHeaderSize));
+                records.append(data);
+            }
+            if(file_.write(records) != records.size() || !syncToDisk(file_))
+                qWarning("QCommandHistoryJournal: failed to write %s: %s",
+                         qPrintable(file_.fileName()), qPrintable(file_.errorString()));
+
+            locker.relock();
+            busy_ = false;
+            written_.wakeAll();
+        }
+    }
+};
+
+QCommandHistoryJournal::QCommandHistoryJournal()
+    : writer_(nullptr),
+      batchInterval_(50)
+{
+}
+
+QCommandHistoryJournal::~QCommandHistoryJournal()
+{
+    close();
+}
+
+/*!
+ * \brief Open a journal for appending, creating it if needed
+ * \param fileName The file name
+ * \return true on success
+ *
+ * If the journal ends with an incomplete or corrupted record (e.g. after a
+ * crash), the file is truncated after the last valid record. A non-empty
+ * file without a valid journal header is refused, and left untouched.
+ */
+bool QCommandHistoryJournal::open(const QString &fileName)
+{
+    close();
+
+    Writer *writer = new Writer;
+    writer->batchInterval_ = batchInterval_;
+    writer->file_.setFileName(fileName);
+    if(!writer->file_.open(QIODevice::ReadWrite))
+    {
+        delete writer;
+        return false;
+    }
+
+    qint64 validSize = 0;
+    read(fileName, &validSize);
+    bool ok = true;
+    if(writer->file_.size() == 0)
+    {
+        QByteArray header(int(headerSize), 0);
+        memcpy(header.data(), magic, 4);
+        qToLittleEndian<quint32>(version, header.data() + 4);
+        ok = writer->file_.write(header) == headerSize && syncToDisk(writer->file_);
+    }
+    else if(validSize == 0)
+    {
+        // (not a journal, or a journal of another version: leave it alone)
+        ok = false;
+    }
+    else if(validSize < writer->file_.size())
+    {
+        ok = writer->file_.resize(validSize);
+    }
+    if(!ok || !writer->file_.seek(writer->file_.size()))
+    {
+        delete writer;
+        return false;
+    }
+
+    writer_ = writer;
+    writer_->start();
+    return true;
+}
+
+/*!
+ * \brief Write all the pending entries and close the journal
+ */
+void QCommandHistoryJournal::close()
+{
+    if(!writer_) return;
+
+    {
+        QMutexLocker locker(&writer_->mutex_);
+        writer_->stop_ = true;
+        writer_->queued_.wakeAll();
+    }
+    writer_->wait();
+    delete writer_;
+    writer_ = nullptr;
+}
+
+bool QCommandHistoryJournal::isOpen() const
+{
+    return writer_ != nullptr;
+}
+
+/*!
+ * \brief Set for how long the writer waits for more entries before syncing
+ * \param msec The interval in milliseconds
+ *
+ * A crash can lose the entries appended during the last interval.
+ */
+void QCommandHistoryJournal::setBatchInterval(int msec)
+{
+    batchInterval_ = qMax(0, msec);
+    if(writer_)
+    {
+        QMutexLocker locker(&writer_->mutex_);
+        writer_->batchInterval_ = batchInterval_;
+    }
+}
+
+int QCommandHistoryJournal::batchInterval() const
+{
+    return batchInterval_;
+}
+
+/*!
+ * \brief Queue an entry for writing; this never waits for disk I/O
+ * \param entry The entry
+ */
+void QCommandHistoryJournal::append(const QString &entry)
+{
+    if(!writer_) return;
+
+    QMutexLocker locker(&writer_->mutex_);
+    writer_->pending_.append(entry);
+    writer_->queued_.wakeAll();
+}
+
+/*!
+ * \brief Wait until all the queued entries are written and synced
+ */
+void QCommandHistoryJournal::flush()
+{
+    if(!writer_) return;
+
+    QMutexLocker locker(&writer_->mutex_);
+    int interval = writer_->batchInterval_;
+    writer_->batchInterval_ = 0;
+    writer_->queued_.wakeAll();
+    while(!writer_->pending_.isEmpty() || writer_->busy_)
+        writer_->written_.wait(&writer_->mutex_);
+    writer_->batchInterval_ = interval;
+}
+
+/*!
+ * \brief Read the entries of a journal
+ * \param fileName The file name
+ * \param validSize If not null, set to the size of the valid part of the file
+ * (0 if the file is missing or has no valid header)
+ * \return The entries, up to the first incomplete or corrupted record
+ */
+QStringList QCommandHistoryJournal::read(const QString &fileName, qint64 *validSize)
+{
+    QStringList entries;
+    if(validSize) *validSize = 0;
+
+    QFile f(fileName);
+    if(!f.open(QIODevice::ReadOnly))
+        return entries;
+    QByteArray content = f.readAll();
+    const char *p = content.constData();
+    qint64 size = content.size();
+
+    if(size < headerSize || memcmp(p, magic, 4) != 0 || qFromLittleEndian<quint32>(p + 4) != version)
+        return entries;
+
+    qint64 pos = headerSize;
+    while(size - pos >= recordHeaderSize)
+    {
+        quint32 len = qFromLittleEndian<quint32>(p + pos);
+        quint32 crc = qFromLittleEndian<quint32>(p + pos + 4);
+        if(len > quint64(size - pos - recordHeaderSize))
+            break;
+        const char *data = p + pos + recordHeaderSize;
+        if(crc32(data, int(len)) != crc)
+            break;
+        entries.append(QString::fromUtf8(data, int(len)));
+        pos += recordHeaderSize + len;
+    }
+
+    if(validSize) *validSize = pos;
+    return entries;
+}
+
+/*!
+ * \brief Merge a journal into a history file snapshot and empty the journal
+ * \param journalFileName The journal file name
+ * \param snapshotFileName The history file name (see QCommandHistoryFile)
+ * \return true on success
+ *
+ * Duplicate entries are removed, keeping only the most recent occurrence.
+ * The journal must not be open for appending while compacting it. If the
+ * snapshot exists but cannot be read, false is returned, and both files are
+ * left untouched; the same goes for a journal without a valid header.
+ */
+bool QCommandHistoryJournal::compact(const QString &journalFileName, const QString &snapshotFileName)
+{
+    QStringList all;
+    QCommandHistory snapshot;
+    if(QFile::exists(snapshotFileName))
+    {
+        // (an unreadable snapshot would be replaced by the journal alone)
+        if(!snapshot.load(snapshotFileName))
+            return false;
+        all.reserve(snapshot.count());
+        for(int i = 0; i < snapshot.count(); i++)
+            all.append(snapshot.at(i));
+    }
+    qint64 validSize = 0;
+    all += read(journalFileName, &validSize);
+    if(validSize == 0 && QFileInfo(journalFileName).size() > 0)
+        return false;
+
+    QSet<QString> seen;
+    QStringList unique;
+    for(int i = all.length() - 1; i >= 0; i--)
+    {
+        if(seen.contains(all[i])) continue;
+        seen.insert(all[i]);
+        unique.prepend(all[i]);
+    }
+
+    snapshot.set(unique);
+    if(!snapshot.save(snapshotFileName))
+        return false;
+
+    QFile journal(journalFileName);
+    return !journal.exists() || journal.remove();
+}
@@ -0,0 +1,61 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef QCOMMANDHISTORYJOURNAL_H
+#define QCOMMANDHISTORYJOURNAL_H
+
+#include <QStringList>
+
+/*!
+ * \brief Append-only history journal, written by a background thread
+ *
+ * Entries passed to append() are queued and written by a writer thread,
+ * which syncs the file to disk once per batch. Every record is framed with
+ * its length and a CRC-32 checksum, so that a crash can only lose the last
+ * (partially written) batch: when the journal is read back or reopened,
+ * reading stops at the first incomplete or corrupted record.
+ *
+ * compact() merges a journal into a history file snapshot (see
+ * QCommandHistoryFile), removing duplicates, and empties the journal.
+ */
+class QCommandHistoryJournal
+{
+public:
+    QCommandHistoryJournal();
+    ~QCommandHistoryJournal();
+
+    bool open(const QString &fileName);
+    void close();
+    bool isOpen() const;
+
+    void setBatchInterval(int msec);
+    int batchInterval() const;
+
+    void append(const QString &entry);
+    void flush();
+
+    static QStringList read(const QString &fileName, qint64 *validSize = nullptr);
+    static bool compact(const QString &journalFileName, const QString &snapshotFileName);
+
+private:
+    Q_DISABLE_COPY(QCommandHistoryJournal)
+
+    class Writer;
+    Writer *writer_;
+    int batchInterval_;
+};
+
+#endif // QCOMMANDHISTORYJOURNAL_H
@@ -0,0 +1,250 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "qcommandhistorymodel.h"
+
+#include <QtConcurrent>
+
+QCommandHistoryModel::QCommandHistoryModel(QObject *parent)
+    : QObject(parent),
+      version_(0),
+      snapshotVersion_(-1),
+      indexWatcher_(new QFutureWatcher<QSharedPointer<QCommandHistory> >(this))
+{
+    connect(indexWatcher_, &QFutureWatcherBase::finished, this, &QCommandHistoryModel::onIndexUpdated);
+}
+
+QCommandHistoryModel::~QCommandHistoryModel()
+{
+    indexCancel_.storeRelease(1);
+    indexWatcher_->waitForFinished();
+}
+
+/*!
+ * \brief Return the history
+ *
+ * The reference must be used only in the thread the model lives in; other
+ * threads must use snapshot().
+ */
+const QCommandHistory & QCommandHistoryModel::history() const
+{
+    return history_;
+}
+
+/*!
+ * \brief Return an immutable copy of the current version of the history
+ *
+ * This must be called in the thread the model lives in, but the snapshot can
+ * then be passed to, read and searched by any thread. Taking a snapshot is
+ * cheap, as the entries and the index are shared with the model (see
+ * QCommandHistory::snapshot()), and all the snapshots of the same version
+ * are the same object.
+ */
+QSharedPointer<const QCommandHistory> QCommandHistoryModel::snapshot() const
+{
+    if(!snapshot_ || snapshotVersion_ != version_)
+    {
+        snapshot_ = QSharedPointer<const QCommandHistory>(new QCommandHistory(history_.snapshot()));
+        snapshotVersion_ = version_;
+    }
+    return snapshot_;
+}
+
+/*!
+ * \brief Return the version number, incremented by every change
+ */
+int QCommandHistoryModel::version() const
+{
+    return version_;
+}
+
+/*!
+ * \brief Find the most recent entry starting with the given prefix
+ * \param cursor A cursor used to narrow the search incrementally
+ * \param prefix The prefix
+ * \param entry If not null, receives the entry found
+ * \param cancel If not null, the search is abandoned when this becomes non-zero
+ * \return The position of the entry, or -1 if there is no match
+ *
+ * This must be called in the thread the model lives in; other threads search
+ * a snapshot() (see QCommandHistory::mostRecentMatch()).
+ */
+int QCommandHistoryModel::mostRecentMatch(QCommandHistory::Cursor &cursor, const QString &prefix, QString *entry, const QAtomicInt *cancel) const
+{
+    int index = history_.mostRecentMatch(cursor, prefix, cancel);
+    if(entry && index >= 0)
+        *entry = history_.at(index);
+    return index;
+}
+
+/*!
+ * \brief Return the ids of all the entries starting with the given prefix
+ * \param prefix The prefix
+ * \return The ids, in increasing order
+ *
+ * This must be called in the thread the model lives in; other threads search
+ * a snapshot().
+ */
+QVector<int> QCommandHistoryModel::matchingIds(const QString &prefix) const
+{
+    return history_.matchingIds(prefix);
+}
+
+/*!
+ * \brief Replace the history content
+ * \param entries The new history content
+ */
+void QCommandHistoryModel::set(const QStringList &entries)
+{
+    beginChange();
+    indexCancel_.storeRelease(1); // (the entries are renumbered)
+    history_.set(entries);
+    version_++;
+    updateIndexLater();
+    Q_EMIT historyReset();
+}
+
+/*!
+ * \brief Replace the history content with the content of a history file
+ * \param fileName The file name
+ * \return true on success; on failure the history is left unchanged
+ */
+bool QCommandHistoryModel::load(const QString &fileName)
+{
+    beginChange();
+    indexCancel_.storeRelease(1); // (the entries are renumbered)
+    if(!history_.load(fileName))
+        return false;
+    version_++;
+    updateIndexLater();
+    Q_EMIT historyReset();
+    return true;
+}
+
+/*!
+ * \brief Append an entry, dropping the oldest ones if capacity is exceeded
+ * \param entry The new entry
+ */
+void QCommandHistoryModel::append(const QString &entry)
+{
+    appendEntries(QStringList(entry));
+}
+
+/*!
+ * \brief Append many entries at once
+ * \param entries The new entries, oldest first
+ *
+ * This is a single change (one version), notified with an entryAppended()
+ * signal per entry.
+ */
+void QCommandHistoryModel::appendEntries(const QStringList &entries)
+{
+    if(entries.isEmpty())
+        return;
+
+    beginChange();
+    int oldCount = history_.count();
+    int id = history_.idAt(oldCount);
+    for(const QString &entry : entries)
+        history_.append(entry);
+    version_++;
+    updateIndexLater();
+    for(const QString &entry : entries)
+        Q_EMIT entryAppended(entry, id++);
+    int dropped = oldCount + entries.size() - history_.count();
+    if(dropped > 0)
+        Q_EMIT entriesDropped(dropped);
+}
+
+/*!
+ * \brief Remove an entry
+ * \param index Position of the entry
+ *
+ * This is notified with entryRemoved(), or with historyReset() if the
+ * entries are renumbered (see QCommandHistory::remove()).
+ */
+void QCommandHistoryModel::remove(int index)
+{
+    if(index < 0 || index >= history_.count())
+        return;
+
+    beginChange();
+    int id = history_.idAt(index);
+    int revision = history_.revision();
+    history_.remove(index);
+    bool renumbered = history_.revision() != revision;
+    if(renumbered)
+        indexCancel_.storeRelease(1);
+    version_++;
+    updateIndexLater();
+    if(renumbered)
+        Q_EMIT historyReset();
+    else
+        Q_EMIT entryRemoved(id);
+}
+
+/*!
+ * \brief Limit the number of entries
+ * \param capacity The maximum number of entries, or 0 for no limit
+ */
+void QCommandHistoryModel::setCapacity(int capacity)
+{
+    beginChange();
+    int oldCount = history_.count();
+    history_.setCapacity(capacity);
+    version_++;
+    updateIndexLater();
+    if(history_.count() < oldCount)
+        Q_EMIT entriesDropped(oldCount - history_.count());
+}
+
+void QCommandHistoryModel::clear()
+{
+    set(QStringList());
+}
+
+void QCommandHistoryModel::beginChange()
+{
+    Q_EMIT aboutToChange();
+    // (so that the index is not kept shared by the cached snapshot)
+    snapshot_.clear();
+}
+
+void QCommandHistoryModel::updateIndexLater()
+{
+    // (fewer entries are indexed in place by the next append)
+    if(indexWatcher_->isRunning() || history_.unindexedCount() <= QCommandHistory::IndexInPlaceLimit)
+        return;
+
+    indexCancel_.storeRelease(0);
+    QCommandHistory snapshot = history_.snapshot();
+    indexWatcher_->setFuture(QtConcurrent::run([this, snapshot]() {
+        QSharedPointer<QCommandHistory> history(new QCommandHistory(snapshot));
+        history->updateIndex(&indexCancel_);
+        return history;
+    }));
+}
+
+void QCommandHistoryModel::onIndexUpdated()
+{
+    QSharedPointer<QCommandHistory> indexed = indexWatcher_->result();
+    history_.adoptIndex(*indexed);
+    // (release the index, which would otherwise stay shared)
+    *indexed = QCommandHistory();
+
+    // entries appended meanwhile
+    updateIndexLater();
+}
@@ -0,0 +1,96 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef QCOMMANDHISTORYMODEL_H
+#define QCOMMANDHISTORYMODEL_H
+
+#include <QAtomicInt>
+#include <QFutureWatcher>
+#include <QObject>
+#include <QSharedPointer>
+#include <QStringList>
+
+#include "qcommandhistory.h"
+
+/*!
+ * \brief A command history shared by many QCommandEdit widgets
+ *
+ * The entries and the prefix index are kept once, however many widgets are
+ * attached (see QCommandEdit::setHistoryModel()). The model is modified only
+ * by the thread it lives in; every change increments version() and is
+ * notified incrementally: entryAppended() and entriesDropped() for appends
+ * and the capacity limit, entryRemoved() for remove(), historyReset() when
+ * the content is replaced or the entries renumbered.
+ *
+ * snapshot() returns an immutable copy of the current version, which shares
+ * the entries and the prefix index with the model, and can be read and
+ * searched from any thread; the model is never locked. Entries which the
+ * index can't take in place while it is shared, and the entries set() or
+ * load(), are indexed in a background thread, on a snapshot, and the new
+ * index is then installed by the model's thread.
+ */
+class QCommandHistoryModel : public QObject
+{
+    Q_OBJECT
+public:
+    explicit QCommandHistoryModel(QObject *parent = nullptr);
+    ~QCommandHistoryModel();
+
+    const QCommandHistory & history() const;
+    QSharedPointer<const QCommandHistory> snapshot() const;
+    int version() const;
+
+    int mostRecentMatch(QCommandHistory::Cursor &cursor, const QString &prefix, QString *entry, const QAtomicInt *cancel = nullptr) const;
+    QVector<int> matchingIds(const QString &prefix) const;
+
+public Q_SLOTS:
+    void set(const QStringList &entries);
+    bool load(const QString &fileName);
+    void append(const QString &entry);
+    void appendEntries(const QStringList &entries);
+    void remove(int index);
+    void setCapacity(int capacity);
+    void clear();
+
+Q_SIGNALS:
+    void aboutToChange();
+    void historyReset();
+    void entryAppended(const QString &entry, int id);
+    void entriesDropped(int count);
+    void entryRemoved(int id);
+
+private Q_SLOTS:
+    void onIndexUpdated();
+
+private:
+    Q_DISABLE_COPY(QCommandHistoryModel)
+
+    void beginChange();
+    void updateIndexLater();
+
+    QCommandHistory history_;
+    int version_;
+
+    // the last snapshot taken, shared by readers of the same version
+    mutable QSharedPointer<const QCommandHistory> snapshot_;
+    mutable int snapshotVersion_;
+
+    // index update running in the background, on a snapshot:
+    QFutureWatcher<QSharedPointer<QCommandHistory> > *indexWatcher_;
+    QAtomicInt indexCancel_;
+};
+
+#endif // QCOMMANDHISTORYMODEL_H
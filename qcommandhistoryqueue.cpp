@@ -0,0 +1,96 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "qcommandhistoryqueue.h"
+#include "qcommandhistorymodel.h"
+
+#include <QStringList>
+
+QCommandHistoryQueue::QCommandHistoryQueue(QCommandHistoryModel *model, QObject *parent)
+    : QObject(parent),
+      model_(model),
+      head_(nullptr)
+{
+}
+
+/*!
+ * \brief Destroy the queue; entries not drained yet are discarded
+ */
+QCommandHistoryQueue::~QCommandHistoryQueue()
+{
+    Node *node = head_.fetchAndStoreAcquire(nullptr);
+    while(node)
+    {
+        Node *next = node->next_;
+        delete node;
+        node = next;
+    }
+}
+
+/*!
+ * \brief Queue an entry for appending to the history
+ * \param entry The new entry
+ *
+ * This can be called from any thread, and does not block.
+ */
+void QCommandHistoryQueue::append(const QString &entry)
+{
+    Node *node = new Node;
+    node->entry_ = entry;
+    Node *head = head_.loadAcquire();
+    do
+    {
+        node->next_ = head;
+    }
+    while(!head_.testAndSetOrdered(head, node, head));
+
+    // the queue was empty: nobody has scheduled a drain yet
+    if(!head)
+        QMetaObject::invokeMethod(this, [this]() { drain(); }, Qt::QueuedConnection);
+}
+
+/*!
+ * \brief Append all the queued entries to the history, in queue order
+ * \return The number of entries appended
+ *
+ * This is called automatically, and must be called only in the thread the
+ * queue (and the model) live in.
+ */
+int QCommandHistoryQueue::drain()
+{
+    Node *node = head_.fetchAndStoreAcquire(nullptr);
+    if(!node)
+        return 0;
+
+    // the list is most recent first
+    int count = 0;
+    for(Node *n = node; n; n = n->next_)
+        count++;
+    QStringList entries;
+    entries.reserve(count);
+    for(int i = 0; i < count; i++)
+        entries.append(QString());
+    for(int i = count - 1; node; i--)
+    {
+        Node *next = node->next_;
+        entries[i].swap(node->entry_);
+        delete node;
+        node = next;
+    }
+
+    model_->appendEntries(entries);
+    return count;
+}
@@ -0,0 +1,64 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef QCOMMANDHISTORYQUEUE_H
+#define QCOMMANDHISTORYQUEUE_H
+
+#include <QAtomicPointer>
+#include <QObject>
+#include <QString>
+
+class QCommandHistoryModel;
+
+/*!
+ * \brief Lock-free queue of history entries, appended from any thread
+ *
+ * append() can be called by any number of threads at once (e.g. background
+ * scripts, remote sessions): it pushes the entry with a compare-and-swap and
+ * never waits for the thread the queue lives in. The first entry pushed into
+ * an empty queue schedules a drain() in the thread of the queue (normally
+ * the GUI thread), which takes all the queued entries at once and appends
+ * them to the model as a single batch; so the model, and the widgets using
+ * it, are updated at most once per event loop iteration.
+ */
+class QCommandHistoryQueue : public QObject
+{
+    Q_OBJECT
+public:
+    explicit QCommandHistoryQueue(QCommandHistoryModel *model, QObject *parent = nullptr);
+    ~QCommandHistoryQueue();
+
+    void append(const QString &entry);
+
+public Q_SLOTS:
+    int drain();
+
+private:
+    Q_DISABLE_COPY(QCommandHistoryQueue)
+
+    struct Node
+    {
+        QString entry_;
+        Node *next_;
+    };
+
+    QCommandHistoryModel *model_;
+
+    // pushed entries, most recent first
+    QAtomicPointer<Node> head_;
+};
+
+#endif // QCOMMANDHISTORYQUEUE_H
@@ -0,0 +1,367 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "qcommandhistorysearch.h"
+#include "qcommandhistory.h"
+#include "qcommandhistoryfile.h"
+#include "qcommandedit_p.h"
+
+#include <QtAlgorithms>
+#include <QtConcurrent>
+#include <QThread>
+
+#include <algorithm>
+#include <cstring>
+
+// histories smaller than this are scanned by the calling thread:
+static const int parallelThreshold = 1 << 16;
+
+// entries scanned between checks for cancellation:
+static const int cancelCheckInterval = 1 << 12;
+
+#if defined(QCOMMANDEDIT_AVX2)
+static bool cpuHasAvx2()
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int r[4];
+    __cpuid(r, 0);
+    if(r[0] < 7)
+        return false;
+    // AVX must be enabled by the OS too (YMM state saved by XSAVE):
+    __cpuid(r, 1);
+    if(!(r[2] & (1 << 27)) || !(r[2] & (1 << 28)) || (_xgetbv(0) & 6) != 6)
+        return false;
+    __cpuidex(r, 7, 0);
+    return r[1] & (1 << 5);
+#else
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+/*
+ * The AVX2 part of findBytes(): scan 32 positions at a time from *pos,
+ * leaving *pos at the first position not scanned.
+ */
+QCOMMANDEDIT_TARGET_AVX2
+static const char * findBytesAvx2(const char *hay, int n, const char *needle, int m, int *pos)
+{
+    int i = *pos;
+    const __m256i first32 = _mm256_set1_epi8(needle[0]);
+    const __m256i last32 = _mm256_set1_epi8(needle[m - 1]);
+    for(; i + m - 1 + 32 <= n; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hay + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hay + i + m - 1));
+        quint32 mask = quint32(_mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first32), _mm256_cmpeq_epi8(b, last32))));
+        for(; mask; mask &= mask - 1)
+        {
+            int k = i + int(qCountTrailingZeroBits(mask));
+            if(m <= 2 || memcmp(hay + k + 1, needle + 1, size_t(m - 2)) == 0)
+                return hay + k;
+        }
+    }
+    *pos = i;
+    return nullptr;
+}
+#endif
+
+static QCommandEditSimd supportedSimd()
+{
+#if defined(QCOMMANDEDIT_AVX2)
+    if(cpuHasAvx2())
+        return QCommandEditAvx2;
+#endif
+#if defined(QCOMMANDEDIT_SSE2)
+    return QCommandEditSse2;
+#else
+    return QCommandEditScalar;
+#endif
+}
+
+// the instruction set used by findBytes(), or -1 for the supported one:
+static QBasicAtomicInt simdLevel = Q_BASIC_ATOMIC_INITIALIZER(-1);
+
+QCommandEditSimd qCommandEditSimd()
+{
+    static const QCommandEditSimd supported = supportedSimd();
+    int level = simdLevel.loadAcquire();
+    return level < 0 ? supported : QCommandEditSimd(level);
+}
+
+/*
+ * Limit the instruction set used by findBytes() (for tests); return the one
+ * actually used, which is at most the supported one.
+ */
+QCommandEditSimd qCommandEditSetSimd(QCommandEditSimd simd)
+{
+    simdLevel.storeRelease(-1);
+    QCommandEditSimd level = qMin(simd, qCommandEditSimd());
+    simdLevel.storeRelease(level);
+    return level;
+}
+
+/*
+ * Find needle in haystack: compare the first and the last byte of the needle
+ * against 32 (AVX2) or 16 (SSE2) positions at once, and compare the whole
+ * needle only where both match.
+ */
+static const char * findBytes(const char *hay, int n, const char *needle, int m)
+{
+    if(m == 0) return hay;
+    if(m > n) return nullptr;
+
+    int i = 0;
+    QCommandEditSimd simd = qCommandEditSimd();
+    Q_UNUSED(simd);
+#if defined(QCOMMANDEDIT_AVX2)
+    if(simd == QCommandEditAvx2)
+        if(const char *p = findBytesAvx2(hay, n, needle, m, &i))
+            return p;
+#endif
+#if defined(QCOMMANDEDIT_SSE2)
+    const __m128i first16 = _mm_set1_epi8(needle[0]);
+    const __m128i last16 = _mm_set1_epi8(needle[m - 1]);
+    for(; simd >= QCommandEditSse2 && i + m - 1 + 16 <= n; i += 16)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(hay + i + m - 1));
+        quint32 mask = quint32(_mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first16), _mm_cmpeq_epi8(b, last16))));
+        for(; mask; mask &= mask - 1)
+        {
+            int k = i + int(qCountTrailingZeroBits(mask));
+            if(m <= 2 || memcmp(hay + k + 1, needle + 1, size_t(m - 2)) == 0)
+                return hay + k;
+        }
+    }
+#endif
+    for(; i + m <= n; i++)
+        if(hay[i] == needle[0] && memcmp(hay + i, needle, size_t(m)) == 0)
+            return hay + i;
+    return nullptr;
+}
+
+const char * qCommandEditFindBytes(const char *hay, int n, const char *needle, int m)
+{
+    return findBytes(hay, n, needle, m);
+}
+
+QCommandHistorySearch::QCommandHistorySearch()
+{
+    reset();
+}
+
+/*!
+ * \brief Find the most recent entry matching the query, before a position
+ * \param history The history
+ * \param query The query; an empty query matches nothing
+ * \param mode The kind of match
+ * \param from Only entries at positions below this are considered
+ * \param cancel If not null, the search is abandoned when this becomes non-zero
+ * \return The position of the entry, or -1 if there is no match
+ *
+ * Queries are case sensitive.
+ */
+int QCommandHistorySearch::search(const QCommandHistory &history, const QString &query, Mode mode, int from, const QAtomicInt *cancel)
+{
+    if(query.isEmpty())
+        return -1;
+
+    // (revisions are unique, and shared only by snapshots of a history, whose
+    // entries differ only by the ones appended, which are handled below)
+    bool sameHistory = revision_ == history.revision();
+    if(!sameHistory || mode != mode_ || query != query_)
+    {
+        // entries matching an extended query are a subset of the entries
+        // matching the previous one (or of the candidates left by a cancelled
+        // search for it), otherwise all entries are candidates:
+        bool narrow = sameHistory && mode == mode_ && !query_.isEmpty() && query.startsWith(query_);
+        setQuery(query);
+        mode_ = mode;
+        if(!narrow)
+        {
+            uniqueMatches_.fill(1, history.entries_.uniqueCount());
+            fileMatches_.fill(1, history.file_ ? history.file_->count() : 0);
+        }
+        revision_ = history.revision();
+        complete_ = false;
+    }
+
+    // distinct entries added since the last search are candidates too:
+    int uniques = history.entries_.uniqueCount();
+    if(uniqueMatches_.size() < uniques)
+    {
+        int begin = uniqueMatches_.size();
+        uniqueMatches_.resize(uniques);
+        std::fill(uniqueMatches_.begin() + begin, uniqueMatches_.end(), quint8(1));
+        complete_ = false;
+    }
+
+    // candidates are only ever cleared, so when the scan is cancelled (e.g.
+    // because the query was extended), the next search resumes from them
+    if(!complete_)
+    {
+        if(!scan(history, 0, uniques, cancel) || !scanFile(history, cancel))
+            return -1;
+        complete_ = true;
+    }
+
+    if(from <= 0)
+        return -1;
+
+    // walk the entries by id, skipping the removed ones; r is the number of
+    // removed ids below id
+    const QVector<int> &removed = history.removed_;
+    int id = history.idAt(qMin(from, history.count())) - 1;
+    int r = int(std::lower_bound(removed.cbegin(), removed.cend(), id + 1) - removed.cbegin());
+    for(; id >= history.firstId_; id--)
+    {
+        if(r > 0 && removed.at(r - 1) == id)
+        {
+            r--;
+            continue;
+        }
+        int slot = id - history.firstId_;
+        bool match = slot >= history.fileCount_
+                ? uniqueMatches_.at(history.entries_.uniqueAt(slot - history.fileCount_))
+                : fileMatches_.at(history.fileFirst_ + slot);
+        if(match)
+            return slot - r;
+    }
+    return -1;
+}
+
+/*!
+ * \brief Forget the results of the last scan, and free the match flags
+ */
+void QCommandHistorySearch::reset()
+{
+    revision_ = 0;
+    complete_ = false;
+    query_.clear();
+    mode_ = Substring;
+    // (clear() would keep the capacity)
+    uniqueMatches_ = QVector<quint8>();
+    fileMatches_ = QVector<quint8>();
+}
+
+void QCommandHistorySearch::setQuery(const QString &query)
+{
+    query_ = query;
+
+    latin1_.valid_ = true;
+    for(QChar c : query)
+        if(c.unicode() > 0xFF)
+            latin1_.valid_ = false;
+    latin1_.bytes_ = latin1_.valid_ ? query.toLatin1() : QByteArray();
+    utf8_.bytes_ = query.toUtf8();
+    utf8_.valid_ = true;
+
+    // fuzzy matching is done one character at a time:
+    latin1_.chars_.clear();
+    utf8_.chars_.clear();
+    for(int i = 0; i < query.length(); i++)
+    {
+        int n = query.at(i).isHighSurrogate() && i + 1 < query.length() ? 2 : 1;
+        QString c = query.mid(i, n);
+        if(latin1_.valid_)
+            latin1_.chars_.append(c.toLatin1());
+        utf8_.chars_.append(c.toUtf8());
+        i += n - 1;
+    }
+}
+
+bool QCommandHistorySearch::scan(const QCommandHistory &history, int begin, int end, const QAtomicInt *cancel)
+{
+    const QCommandHistoryStorage &storage = history.entries_;
+    quint8 *flags = uniqueMatches_.data();
+    return parallelFor(begin, end, cancel, [&](int b, int e) {
+        for(int uid = b; uid < e; uid++)
+        {
+            if(!flags[uid]) continue;
+            int size;
+            bool utf8;
+            const char *data = storage.uniqueData(uid, &size, &utf8);
+            flags[uid] = matches(data, size, utf8);
+        }
+    });
+}
+
+bool QCommandHistorySearch::scanFile(const QCommandHistory &history, const QAtomicInt *cancel)
+{
+    if(!history.file_) return true;
+
+    const QCommandHistoryFile &file = *history.file_;
+    quint8 *flags = fileMatches_.data();
+    // (entries dropped by the capacity limit are not scanned)
+    return parallelFor(history.fileFirst_, file.count(), cancel, [&](int b, int e) {
+        for(int i = b; i < e; i++)
+        {
+            if(!flags[i]) continue;
+            int size;
+            const char *data = file.data(i, &size);
+            flags[i] = data && matches(data, size, true);
+        }
+    });
+}
+
+bool QCommandHistorySearch::matches(const char *data, int size, bool utf8) const
+{
+    const Needle &needle = utf8 ? utf8_ : latin1_;
+    if(!needle.valid_)
+        return false;
+
+    if(mode_ == Substring)
+        return findBytes(data, size, needle.bytes_.constData(), needle.bytes_.size());
+
+    int pos = 0;
+    for(const QByteArray &c : needle.chars_)
+    {
+        const char *p = findBytes(data + pos, size - pos, c.constData(), c.size());
+        if(!p) return false;
+        pos = int(p - data) + c.size();
+    }
+    return true;
+}
+
+/*
+ * Call f on subranges of [begin, end), in parallel if the range is large;
+ * subranges are small enough to check for cancellation regularly.
+ * Return false if cancelled.
+ */
+template<typename F>
+bool QCommandHistorySearch::parallelFor(int begin, int end, const QAtomicInt *cancel, F f)
+{
+    auto run = [&](int b, int e) {
+        for(; b < e && !(cancel && cancel->loadAcquire()); b += cancelCheckInterval)
+            f(b, qMin(e, b + cancelCheckInterval));
+    };
+
+    if(end - begin < parallelThreshold)
+    {
+        run(begin, end);
+    }
+    else
+    {
+        QVector<Range> ranges;
+        int n = qMax(1, QThread::idealThreadCount());
+        int step = (end - begin + n - 1) / n;
+        for(int b = begin; b < end; b += step)
+            ranges.append(Range{b, qMin(end, b + step)});
+        QtConcurrent::blockingMap(ranges, [&](const Range &r) { run(r.begin_, r.end_); });
+    }
+    return !(cancel && cancel->loadAcquire());
+}
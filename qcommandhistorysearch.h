@@ -0,0 +1,87 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef QCOMMANDHISTORYSEARCH_H
+#define QCOMMANDHISTORYSEARCH_H
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QString>
+#include <QVector>
+
+class QCommandHistory;
+
+/*!
+ * \brief Substring and fuzzy search over a QCommandHistory
+ *
+ * The search scans the encoded text of the entries directly (each distinct
+ * entry only once), with SSE2/AVX2 when available, splitting large histories
+ * across threads. The result of the last scan is kept, so that when the
+ * query is extended (e.g. as the user types) only the entries that matched
+ * the previous query are scanned again; this also holds when the previous
+ * scan was cancelled, as the entries it had not ruled out yet are kept as
+ * candidates.
+ */
+class QCommandHistorySearch
+{
+public:
+    enum Mode
+    {
+        Substring,  // entries containing the query
+        Fuzzy       // entries containing the characters of the query, in order
+    };
+
+    QCommandHistorySearch();
+
+    int search(const QCommandHistory &history, const QString &query, Mode mode, int from, const QAtomicInt *cancel = nullptr);
+    void reset();
+
+private:
+    struct Needle
+    {
+        QByteArray bytes_;
+        QVector<QByteArray> chars_;
+        bool valid_;
+    };
+
+    struct Range
+    {
+        int begin_;
+        int end_;
+    };
+
+    void setQuery(const QString &query);
+    bool scan(const QCommandHistory &history, int begin, int end, const QAtomicInt *cancel);
+    bool scanFile(const QCommandHistory &history, const QAtomicInt *cancel);
+    bool matches(const char *data, int size, bool utf8) const;
+    template<typename F>
+    static bool parallelFor(int begin, int end, const QAtomicInt *cancel, F f);
+
+    int revision_; // of the history scanned, see QCommandHistory::revision()
+    QString query_;
+    Mode mode_;
+    Needle latin1_;
+    Needle utf8_;
+
+    // match flags of distinct entries of the in-memory storage, and of the
+    // entries of the history file; until the scan for query_ is complete,
+    // they flag the candidates (a superset of the matches):
+    bool complete_;
+    QVector<quint8> uniqueMatches_;
+    QVector<quint8> fileMatches_;
+};
+
+#endif // QCOMMANDHISTORYSEARCH_H
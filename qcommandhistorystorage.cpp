@@ -0,0 +1,306 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "qcommandhistorystorage.h"
+
+#include <QHash>
+
+#include <algorithm>
+#include <cstring>
+
+QCommandHistoryStorage::QCommandHistoryStorage()
+    : first_(0),
+      count_(0),
+      uniqueCount_(0),
+      lastBlockUsed_(0)
+{
+}
+
+/*!
+ * \brief Make a copy sharing the pages of other
+ *
+ * The intern table is not copied: the copy rebuilds it if it is appended to.
+ */
+QCommandHistoryStorage::QCommandHistoryStorage(const QCommandHistoryStorage &other)
+    : entries_(other.entries_),
+      first_(other.first_),
+      count_(other.count_),
+      uniques_(other.uniques_),
+      uniqueCount_(other.uniqueCount_),
+      blocks_(other.blocks_),
+      lastBlockUsed_(other.lastBlockUsed_)
+{
+}
+
+QCommandHistoryStorage & QCommandHistoryStorage::operator=(const QCommandHistoryStorage &other)
+{
+    if(this != &other)
+    {
+        entries_ = other.entries_;
+        first_ = other.first_;
+        count_ = other.count_;
+        uniques_ = other.uniques_;
+        uniqueCount_ = other.uniqueCount_;
+        blocks_ = other.blocks_;
+        lastBlockUsed_ = other.lastBlockUsed_;
+        internTable_.clear();
+        internHashes_.clear();
+    }
+    return *this;
+}
+
+void QCommandHistoryStorage::clear()
+{
+    QCommandHistoryStorage empty;
+    swap(empty);
+}
+
+/*!
+ * \brief Append an entry
+ * \param entry The entry
+ */
+void QCommandHistoryStorage::append(const QString &entry)
+{
+    bool utf8 = false;
+    for(QChar c : entry)
+    {
+        if(c.unicode() > 0xFF)
+        {
+            utf8 = true;
+            break;
+        }
+    }
+    QByteArray bytes = utf8 ? entry.toUtf8() : entry.toLatin1();
+    uint hash = uint(qHashBits(bytes.constData(), size_t(bytes.size()), utf8 ? 1 : 0));
+
+    int uid = findOrAddUnique(bytes, utf8, hash);
+    appendToPages(entries_, first_ + count_, quint32(uid));
+    count_++;
+}
+
+/*!
+ * \brief Remove the oldest entry
+ *
+ * The text of the entry is not reclaimed, even if there are no more
+ * occurrences of it.
+ */
+void QCommandHistoryStorage::removeFirst()
+{
+    if(count_ == 0) return;
+
+    first_++;
+    count_--;
+    if(first_ == PageSize)
+    {
+        entries_.removeFirst();
+        first_ = 0;
+    }
+}
+
+void QCommandHistoryStorage::swap(QCommandHistoryStorage &other)
+{
+    entries_.swap(other.entries_);
+    qSwap(first_, other.first_);
+    qSwap(count_, other.count_);
+    uniques_.swap(other.uniques_);
+    qSwap(uniqueCount_, other.uniqueCount_);
+    blocks_.swap(other.blocks_);
+    qSwap(lastBlockUsed_, other.lastBlockUsed_);
+    internTable_.swap(other.internTable_);
+    internHashes_.swap(other.internHashes_);
+}
+
+int QCommandHistoryStorage::count() const
+{
+    return count_;
+}
+
+QString QCommandHistoryStorage::at(int index) const
+{
+    quint32 header;
+    const char *data = uniqueRecord(uniqueAt(index), &header);
+    int len = int(header >> 1);
+    return header & 1 ? QString::fromUtf8(data, len) : QString::fromLatin1(data, len);
+}
+
+/*!
+ * \brief Return the number of distinct entries stored
+ */
+int QCommandHistoryStorage::uniqueCount() const
+{
+    return uniqueCount_;
+}
+
+/*!
+ * \brief Return the id of the distinct entry stored at the given position
+ * \param index Position of the entry
+ */
+int QCommandHistoryStorage::uniqueAt(int index) const
+{
+    int i = first_ + index;
+    return int(entries_.at(i / PageSize)->data_[i % PageSize]);
+}
+
+/*!
+ * \brief Return the encoded text of a distinct entry, without decoding it
+ * \param uid The id of the distinct entry, between 0 and uniqueCount() - 1
+ * \param size Set to the length of the text, in bytes
+ * \param utf8 Set to true if the text is encoded as UTF-8, false if Latin-1
+ */
+const char * QCommandHistoryStorage::uniqueData(int uid, int *size, bool *utf8) const
+{
+    quint32 header;
+    const char *data = uniqueRecord(uid, &header);
+    *size = int(header >> 1);
+    *utf8 = header & 1;
+    return data;
+}
+
+/*!
+ * \brief Return the memory allocated by this storage, in bytes
+ *
+ * Pages shared with copies are accounted for in full.
+ */
+qint64 QCommandHistoryStorage::memoryUsage() const
+{
+    qint64 total = sizeof(*this);
+    total += entries_.capacity() * qint64(sizeof(QSharedPointer<Page<quint32> >));
+    total += entries_.size() * qint64(sizeof(Page<quint32>));
+    total += uniques_.capacity() * qint64(sizeof(QSharedPointer<Page<quint64> >));
+    total += uniques_.size() * qint64(sizeof(Page<quint64>));
+    total += blocks_.capacity() * qint64(sizeof(QSharedPointer<Block>));
+    for(const QSharedPointer<Block> &b : blocks_)
+        total += sizeof(Block) + b->data_.capacity();
+    total += internTable_.capacity() * qint64(sizeof(quint32));
+    total += internHashes_.capacity() * qint64(sizeof(uint));
+    return total;
+}
+
+template<typename T>
+void QCommandHistoryStorage::appendToPages(QVector<QSharedPointer<Page<T> > > &pages, int index, T value)
+{
+    int p = index / PageSize, slot = index % PageSize;
+    if(p == pages.size())
+    {
+        pages.append(QSharedPointer<Page<T> >(new Page<T>));
+        pages.at(p)->used_ = 0;
+    }
+    else if(pages.at(p)->used_ != slot)
+    {
+        // the page is shared with a copy which has already appended past
+        // this point => stop sharing it
+        QSharedPointer<Page<T> > page(new Page<T>);
+        std::copy(pages.at(p)->data_, pages.at(p)->data_ + slot, page->data_);
+        pages[p] = page;
+    }
+    // (const access, to not detach the page list on every append)
+    const QSharedPointer<Page<T> > &page = pages.at(p);
+    page->data_[slot] = value;
+    page->used_ = slot + 1;
+}
+
+int QCommandHistoryStorage::findOrAddUnique(const QByteArray &bytes, bool utf8, uint hash)
+{
+    if(internTable_.size() < 2 * (uniqueCount_ + 1))
+        rebuildInternTable();
+
+    quint32 header = quint32(bytes.size()) << 1 | (utf8 ? 1 : 0);
+    int mask = internTable_.size() - 1;
+    int i = int(hash) & mask;
+    while(internTable_.at(i))
+    {
+        int uid = int(internTable_.at(i)) - 1;
+        if(internHashes_.at(uid) == hash)
+        {
+            quint32 h;
+            const char *data = uniqueRecord(uid, &h);
+            if(h == header && memcmp(data, bytes.constData(), size_t(bytes.size())) == 0)
+                return uid;
+        }
+        i = (i + 1) & mask;
+    }
+
+    int uid = uniqueCount_;
+    appendToPages(uniques_, uid, appendToArena(bytes, utf8));
+    uniqueCount_++;
+    internHashes_.append(hash);
+    internTable_[i] = quint32(uid) + 1;
+    return uid;
+}
+
+quint64 QCommandHistoryStorage::appendToArena(const QByteArray &bytes, bool utf8)
+{
+    int need = int(sizeof(quint32)) + bytes.size();
+    if(blocks_.isEmpty()
+            || blocks_.constLast()->used_ != lastBlockUsed_
+            || blocks_.constLast()->data_.size() - lastBlockUsed_ < need)
+    {
+        // start a new block (also if the last block is shared with a copy
+        // which has already appended to it)
+        QSharedPointer<Block> block(new Block);
+        block->data_.resize(qMax(int(BlockSize), need));
+        block->used_ = 0;
+        blocks_.append(block);
+        lastBlockUsed_ = 0;
+    }
+
+    const QSharedPointer<Block> &block = blocks_.constLast();
+    quint32 header = quint32(bytes.size()) << 1 | (utf8 ? 1 : 0);
+    char *data = block->data_.data() + lastBlockUsed_;
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + sizeof(header), bytes.constData(), size_t(bytes.size()));
+
+    quint64 location = quint64(blocks_.size() - 1) << 32 | quint32(lastBlockUsed_);
+    lastBlockUsed_ += need;
+    block->used_ = lastBlockUsed_;
+    return location;
+}
+
+const char * QCommandHistoryStorage::uniqueRecord(int uid, quint32 *header) const
+{
+    quint64 location = uniques_.at(uid / PageSize)->data_[uid % PageSize];
+    const char *data = blocks_.at(int(location >> 32))->data_.constData() + quint32(location);
+    memcpy(header, data, sizeof(*header));
+    return data + sizeof(*header);
+}
+
+void QCommandHistoryStorage::rebuildInternTable()
+{
+    if(internHashes_.size() != uniqueCount_)
+    {
+        // (a copy has no intern table of its own)
+        internHashes_.resize(uniqueCount_);
+        for(int uid = 0; uid < uniqueCount_; uid++)
+        {
+            quint32 h;
+            const char *data = uniqueRecord(uid, &h);
+            internHashes_[uid] = uint(qHashBits(data, h >> 1, h & 1));
+        }
+    }
+
+    int size = 16;
+    while(size < 4 * (uniqueCount_ + 1))
+        size *= 2;
+    internTable_.fill(0, size);
+    int mask = size - 1;
+    for(int uid = 0; uid < uniqueCount_; uid++)
+    {
+        int i = int(internHashes_.at(uid)) & mask;
+        while(internTable_.at(i))
+            i = (i + 1) & mask;
+        internTable_[i] = quint32(uid) + 1;
+    }
+}
@@ -0,0 +1,98 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef QCOMMANDHISTORYSTORAGE_H
+#define QCOMMANDHISTORYSTORAGE_H
+
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+/*!
+ * \brief Compact storage for history entries
+ *
+ * Distinct entries are stored only once (duplicates are interned thru a hash
+ * table), encoded as Latin-1 when possible or as UTF-8 otherwise, in large
+ * contiguous blocks; each entry then costs 4 bytes plus its share of the
+ * distinct text.
+ *
+ * Storage is append-only and organized in pages which never move once
+ * allocated. Copying a storage is cheap (pages are shared) and the copy is
+ * not affected by later appends to the original, so a copy can be used as a
+ * snapshot, also from another thread.
+ */
+class QCommandHistoryStorage
+{
+public:
+    QCommandHistoryStorage();
+    QCommandHistoryStorage(const QCommandHistoryStorage &other);
+    QCommandHistoryStorage & operator=(const QCommandHistoryStorage &other);
+
+    void clear();
+    void append(const QString &entry);
+    void removeFirst();
+    void swap(QCommandHistoryStorage &other);
+
+    int count() const;
+    QString at(int index) const;
+    int uniqueCount() const;
+    int uniqueAt(int index) const;
+    const char * uniqueData(int uid, int *size, bool *utf8) const;
+    qint64 memoryUsage() const;
+
+private:
+    enum { PageSize = 4096, BlockSize = 65536 };
+
+    template<typename T>
+    struct Page
+    {
+        T data_[PageSize];
+        int used_;
+    };
+
+    struct Block
+    {
+        QVector<char> data_;
+        int used_;
+    };
+
+    template<typename T>
+    static void appendToPages(QVector<QSharedPointer<Page<T> > > &pages, int index, T value);
+    int findOrAddUnique(const QByteArray &bytes, bool utf8, uint hash);
+    quint64 appendToArena(const QByteArray &bytes, bool utf8);
+    const char * uniqueRecord(int uid, quint32 *header) const;
+    void rebuildInternTable();
+
+    // entries (unique ids), starting from position first_ of the first page:
+    QVector<QSharedPointer<Page<quint32> > > entries_;
+    int first_;
+    int count_;
+
+    // location (block << 32 | offset) of each distinct entry:
+    QVector<QSharedPointer<Page<quint64> > > uniques_;
+    int uniqueCount_;
+
+    // text of distinct entries, each preceded by a quint32 header with the
+    // length in bytes and the encoding flag:
+    QVector<QSharedPointer<Block> > blocks_;
+    int lastBlockUsed_;
+
+    // open addressing hash table of unique ids + 1 (not shared by copies):
+    QVector<quint32> internTable_;
+    QVector<uint> internHashes_;
+};
+
+#endif // QCOMMANDHISTORYSTORAGE_H
@@ -15,45 +15,253 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 #include "qcommandtokenizer.h"
+#include "qtablecommandtokenizer.h"
+#include "qcommandedit_p.h"
+
+#include <algorithm>
 
 bool QCommandTokenizer::Token::overlaps(int index) const
 {
     return start_ <= index && index <= end_;
 }
 
+bool QCommandTokenizer::TokenView::overlaps(int index) const
+{
+    return start_ <= index && index <= end_;
+}
+
 void QCommandTokenizer::setCommand(const QString &cmd)
 {
     clear();
     command_ = cmd;
-    tokenize();
+    runTokenize();
 }
 
+/*!
+ * \brief Change the command, re-tokenizing only the affected region
+ * \param pos Position of the edit
+ * \param removed Number of characters removed at pos
+ * \param inserted Text inserted at pos (after the removal)
+ * \return The range of tokens which have changed
+ *
+ * Tokenization restarts at the token touching pos, and stops at the first
+ * point after the edit where the tokenizer is between tokens and the old
+ * tokenization was also between tokens; the tokens after it are kept, with
+ * their offsets shifted. Tokenizers not implementing tokenizeRange() are
+ * re-run on the whole command.
+ */
+QCommandTokenizer::TokenChange QCommandTokenizer::applyEdit(int pos, int removed, const QString &inserted)
+{
+    pos = qBound(0, pos, command_.length());
+    removed = qBound(0, removed, command_.length() - pos);
+    int delta = inserted.length() - removed;
+    commandChanged();
+    command_.replace(pos, removed, inserted);
+
+    TokenChange change;
+    change.first_ = 0;
+    change.removed_ = spans_.size();
+
+    // first token ending at or after pos (it may grow or merge with the edit)
+    int first = findToken(pos).index_;
+    int from = first < spans_.size() ? qMin(spans_[first].start_, pos) : pos;
+
+    QVector<TokenSpan> newTokens;
+    int stop = texts_.isEmpty() ? tokenizeRange(from, pos + inserted.length(), newTokens) : -1;
+    if(stop < 0)
+    {
+        // no incremental support (or texts_ would be renumbered) =>
+        // tokenize everything
+        spans_.clear();
+        runTokenize();
+        change.inserted_ = spans_.size();
+        return change;
+    }
+
+    // continue until the old tokenization is also between tokens at stop
+    int last = first;
+    while(stop < command_.length())
+    {
+        int q = stop - delta;
+        while(last < spans_.size() && spans_[last].end_ <= q)
+            last++;
+        if(last == spans_.size() || spans_[last].start_ >= q)
+            break;
+        stop = tokenizeRange(stop, stop + 1, newTokens);
+    }
+    if(stop == command_.length())
+        last = spans_.size();
+
+    for(int i = last; i < spans_.size(); i++)
+    {
+        spans_[i].start_ += delta;
+        spans_[i].end_ += delta;
+    }
+    spans_.remove(first, last - first);
+    spans_.insert(first, newTokens.size(), TokenSpan());
+    std::copy(newTokens.cbegin(), newTokens.cend(), spans_.begin() + first);
+
+    change.first_ = first;
+    change.removed_ = last - first;
+    change.inserted_ = newTokens.size();
+    return change;
+}
+
+/*!
+ * \brief Return a copy of the tokens
+ *
+ * Iterating the tokenizer (or using tokenAt()) gives the same tokens without
+ * copying them.
+ */
 QList<QCommandTokenizer::Token> QCommandTokenizer::getTokens() const
 {
     QList<QCommandTokenizer::Token> tokens;
-    for(const Token &t : tokens_)
-        tokens << t;
+    for(int i = 0; i < spans_.size(); i++)
+        tokens << toToken(i);
     return tokens;
 }
 
+#ifndef QT_NO_EXCEPTIONS
+/*!
+ * \brief Return the token at the given character position
+ *
+ * Throws if there is no token there; see findToken() for a lookup which
+ * doesn't throw. Not available when building without exceptions.
+ */
 QCommandTokenizer::Token QCommandTokenizer::getTokenAtCharPos(int index) const
 {
-    if(index < 0 || index > command_.length())
+    TokenLookup lookup = findToken(index);
+    if(lookup.kind_ == TokenLookup::OutOfBounds)
         throw "Character index out of bounds";
+    if(lookup.kind_ != TokenLookup::InToken)
+        throw "No token";
+    return toToken(lookup.index_);
+}
+#endif
+
+/*!
+ * \brief Find the token at the given character position
+ * \param index The character position
+ *
+ * Uses a binary search over the (sorted) token offsets. When index is both
+ * at the end of a token and at the start of the next one, the first token is
+ * returned.
+ */
+QCommandTokenizer::TokenLookup QCommandTokenizer::findToken(int index) const
+{
+    TokenLookup lookup;
+    lookup.index_ = -1;
+    if(index < 0 || index > command_.length())
+    {
+        lookup.kind_ = TokenLookup::OutOfBounds;
+        return lookup;
+    }
+
+    // first token ending at or after index
+    QVector<TokenSpan>::const_iterator it = std::lower_bound(spans_.cbegin(), spans_.cend(), index,
+        [](const TokenSpan &t, int i) {
+            return t.end_ < i;
+        });
+    lookup.index_ = int(it - spans_.cbegin());
+    if(it == spans_.cend())
+        lookup.kind_ = TokenLookup::EndOfLine;
+    else if(it->start_ <= index)
+        lookup.kind_ = TokenLookup::InToken;
+    else
+        lookup.kind_ = TokenLookup::BetweenTokens;
+    return lookup;
+}
+
+int QCommandTokenizer::count() const
+{
+    return spans_.size();
+}
+
+QCommandTokenizer::TokenView QCommandTokenizer::tokenAt(int index) const
+{
+    const TokenSpan &t = spans_.at(index);
+    TokenView v;
+    QHash<int, QString>::const_iterator text = texts_.constFind(index);
+    v.token_ = text != texts_.cend() ? QStringView(*text) : QStringView(command_).mid(t.start_, t.end_ - t.start_);
+    v.type_ = t.type_;
+    v.start_ = t.start_;
+    v.end_ = t.end_;
+    return v;
+}
+
+QCommandTokenizer::const_iterator QCommandTokenizer::begin() const
+{
+    return const_iterator(this, 0);
+}
 
-    for(const Token &t : tokens_)
+QCommandTokenizer::const_iterator QCommandTokenizer::end() const
+{
+    return const_iterator(this, spans_.size());
+}
+
+void QCommandTokenizer::runTokenize()
+{
+    texts_.clear();
+    tokenize();
+    for(int i = 0; i < tokens_.size(); i++)
     {
-        if(t.overlaps(index))
-            return t;
+        TokenSpan span;
+        span.type_ = tokens_[i].type_;
+        span.start_ = tokens_[i].start_;
+        span.end_ = tokens_[i].end_;
+        if(tokens_[i].token_ != command_.mid(span.start_, span.end_ - span.start_))
+            texts_.insert(spans_.size(), tokens_[i].token_);
+        spans_.append(span);
     }
+    tokens_.clear();
+}
 
-    throw "No token";
+QCommandTokenizer::Token QCommandTokenizer::toToken(int index) const
+{
+    const TokenSpan &span = spans_.at(index);
+    Token t;
+    t.token_ = texts_.value(index, command_.mid(span.start_, span.end_ - span.start_));
+    t.type_ = span.type_;
+    t.start_ = span.start_;
+    t.end_ = span.end_;
+    return t;
+}
+
+/*!
+ * \brief Tokenize part of the command, for incremental tokenization
+ * \param from Position where to start, which is at the start of a token or
+ * between tokens
+ * \param until Position after which to stop
+ * \param tokens List where tokens are appended
+ * \return The first position not before until where the tokenizer is
+ * between tokens (or the command length), or -1 if not supported
+ */
+int QCommandTokenizer::tokenizeRange(int from, int until, QVector<TokenSpan> &tokens) const
+{
+    Q_UNUSED(from);
+    Q_UNUSED(until);
+    Q_UNUSED(tokens);
+    return -1;
+}
+
+/*!
+ * \brief Called before the command is changed by clear() (and thus
+ * setCommand()) or applyEdit()
+ *
+ * Tokenizers keeping state between calls (e.g. for streaming input) end it
+ * here.
+ */
+void QCommandTokenizer::commandChanged()
+{
 }
 
 void QCommandTokenizer::clear()
 {
+    commandChanged();
     command_ = "";
+    spans_.clear();
     tokens_.clear();
+    texts_.clear();
 }
 
 bool QSimpleCommandTokenizer::isSeparator(QChar c) const
@@ -63,26 +271,61 @@ bool QSimpleCommandTokenizer::isSeparator(QChar c) const
 
 void QSimpleCommandTokenizer::tokenize()
 {
-    Token cur;
-    cur.type_ = cur.start_ = cur.end_ = 0;
+    tokenizeRange(0, command_.length(), spans_);
+}
 
+int QSimpleCommandTokenizer::tokenizeRange(int from, int until, QVector<TokenSpan> &tokens) const
+{
+    int start = from;
     int n = command_.length();
-    for(int i = 0; i <= n; i++)
+    for(int i = from; i <= n; i++)
     {
-        QChar c = i < n ? command_.at(i) : ' ';
-        if(i == n || isSeparator(c))
+        if(i == n || isSeparator(command_.at(i)))
         {
-            if(!cur.token_.isEmpty())
+            if(i > start)
             {
-                cur.end_ = i;
-                tokens_.append(cur);
-                cur.token_ = "";
+                TokenSpan t;
+                t.type_ = 0;
+                t.start_ = start;
+                t.end_ = i;
+                tokens.append(t);
             }
-            cur.start_ = cur.end_ = i + 1;
-        }
-        else
-        {
-            cur.token_.append(c);
+            if(i >= until)
+                return i;
+            start = i + 1;
         }
     }
+    return n;
+}
+
+/*!
+ * \brief Skip the characters which can't be separators, 8 at a time
+ * \param maxSep Highest ASCII separator, or -1
+ * \return The start of the first block of 8 characters containing a
+ * character at or below maxSep or above ASCII, or of the incomplete block at
+ * the end; i if SSE2 is not available
+ */
+int QCommandTokenizerPrivate::skipAboveAscii(const QChar *data, int i, int n, int maxSep)
+{
+#if defined(QCOMMANDEDIT_SSE2)
+    const __m128i maxSep8 = _mm_set1_epi16(short(maxSep < 0 ? 0 : maxSep));
+    const __m128i nonAscii8 = _mm_set1_epi16(short(0xff80));
+    const __m128i zero = _mm_setzero_si128();
+    for(; i + 8 <= n; i += 8)
+    {
+        // candidates are x >= 128 or x <= maxSep
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i ascii = _mm_cmpeq_epi16(_mm_and_si128(x, nonAscii8), zero);
+        __m128i candidates = _mm_andnot_si128(ascii, _mm_cmpeq_epi16(zero, zero));
+        if(maxSep >= 0)
+            candidates = _mm_or_si128(candidates, _mm_cmpeq_epi16(_mm_subs_epu16(x, maxSep8), zero));
+        if(_mm_movemask_epi8(candidates) != 0)
+            break;
+    }
+#else
+    Q_UNUSED(data);
+    Q_UNUSED(n);
+    Q_UNUSED(maxSep);
+#endif
+    return i;
 }
@@ -17,8 +17,11 @@
 #ifndef QCOMMANDTOKENIZER_H
 #define QCOMMANDTOKENIZER_H
 
+#include <QHash>
 #include <QString>
+#include <QStringView>
 #include <QList>
+#include <QVector>
 
 class QCommandTokenizer
 {
@@ -35,16 +38,112 @@ public:
         bool overlaps(int index) const;
     };
 
+    /*!
+     * \brief Tokens changed by applyEdit()
+     *
+     * Tokens [first_, first_ + removed_) of the old token list have been
+     * replaced by tokens [first_, first_ + inserted_) of the new token list.
+     * Tokens after them are unchanged, except for their offsets.
+     */
+    struct TokenChange
+    {
+        int first_;
+        int removed_;
+        int inserted_;
+    };
+
+    /*!
+     * \brief A token referring to the text of the command, without copying it
+     *
+     * Valid until the command is changed.
+     */
+    struct TokenView
+    {
+        QStringView token_;
+        int type_;
+        int start_;
+        int end_;
+
+        bool overlaps(int index) const;
+    };
+
+    /*!
+     * \brief Result of findToken()
+     */
+    struct TokenLookup
+    {
+        enum Kind
+        {
+            InToken,        //!< position is inside (or at either end of) token index_
+            BetweenTokens,  //!< position is before token index_, after token index_ - 1
+            EndOfLine,      //!< position is after the last token
+            OutOfBounds     //!< position is not in the command
+        };
+
+        Kind kind_;
+        int index_;
+    };
+
+    class const_iterator
+    {
+    public:
+        const_iterator(const QCommandTokenizer *tokenizer, int index) : tokenizer_(tokenizer), index_(index) {}
+        TokenView operator*() const { return tokenizer_->tokenAt(index_); }
+        const_iterator & operator++() { ++index_; return *this; }
+        bool operator==(const const_iterator &o) const { return index_ == o.index_; }
+        bool operator!=(const const_iterator &o) const { return index_ != o.index_; }
+
+    private:
+        const QCommandTokenizer *tokenizer_;
+        int index_;
+    };
+
     void setCommand(const QString &cmd);
+    QCommandTokenizer::TokenChange applyEdit(int pos, int removed, const QString &inserted);
     QList<QCommandTokenizer::Token> getTokens() const;
+#ifndef QT_NO_EXCEPTIONS
     QCommandTokenizer::Token getTokenAtCharPos(int index) const;
+#endif
+    QCommandTokenizer::TokenLookup findToken(int index) const;
+    int count() const;
+    QCommandTokenizer::TokenView tokenAt(int index) const;
+    const_iterator begin() const;
+    const_iterator end() const;
     void clear();
 
 protected:
+    // a token, as stored by the tokenizer
+    struct TokenSpan
+    {
+        int type_;
+        int start_;
+        int end_;
+    };
+
     virtual void tokenize() = 0;
+    virtual int tokenizeRange(int from, int until, QVector<TokenSpan> &tokens) const;
+    virtual void commandChanged();
 
     QString command_;
+    QVector<TokenSpan> spans_;
+
+    /*!
+     * \brief Tokens added by tokenizers written for the QList<Token> storage
+     *
+     * Tokens appended here by tokenize() are moved to spans_ after it
+     * returns, so this is always empty outside of tokenize(); a token_ text
+     * other than the command text between the offsets (e.g. without quotes)
+     * is kept, and returned by getTokens() and tokenAt(). New tokenizers
+     * should fill spans_.
+     */
     QList<Token> tokens_;
+
+private:
+    void runTokenize();
+    QCommandTokenizer::Token toToken(int index) const;
+
+    // token_ of tokens_ which differ from the command text, by span index
+    QHash<int, QString> texts_;
 };
 
 class QSimpleCommandTokenizer : public QCommandTokenizer
@@ -52,6 +151,7 @@ class QSimpleCommandTokenizer : public QCommandTokenizer
 protected:
     virtual bool isSeparator(QChar c) const;
     void tokenize();
+    int tokenizeRange(int from, int until, QVector<TokenSpan> &tokens) const;
 };
 
 #endif // QCOMMANDTOKENIZER_H
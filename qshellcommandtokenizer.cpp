@@ -0,0 +1,311 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include "qshellcommandtokenizer.h"
+
+#include <climits>
+
+namespace {
+
+enum CharClass
+{
+    Blank, Newline, Other, SingleQuote, DoubleQuote, Backslash,
+    Semicolon, Pipe, Ampersand, Less, Greater,
+    NumCharClasses
+};
+
+enum State
+{
+    Start,          // between tokens
+    InWord,
+    InSingleQuotes,
+    InDoubleQuotes,
+    AfterBackslash,
+    AfterBackslashInDoubleQuotes,
+    AfterPipe,      // | or ||
+    AfterAmpersand, // & or &&
+    AfterGreater,   // > or >>
+    NumStates
+};
+
+// actions, performed in this order:
+enum Action
+{
+    End = 1,        // the current token ends before this char
+    Begin = 2,      // a word starts at this char
+    BeginOp = 4,    // an operator starts at this char
+    EndAfter = 8    // the current token ends after this char
+};
+
+struct Transition
+{
+    quint8 next_;
+    quint8 action_;
+};
+
+const quint8 charClass[128] = {
+    //  0       1       2       3       4       5       6       7
+    Other,  Other,  Other,  Other,  Other,  Other,  Other,  Other,      // 0x00
+    Other,  Blank,  Newline,Other,  Other,  Blank,  Other,  Other,      // 0x08
+    Other,  Other,  Other,  Other,  Other,  Other,  Other,  Other,      // 0x10
+    Other,  Other,  Other,  Other,  Other,  Other,  Other,  Other,      // 0x18
+    Blank,  Other,  DoubleQuote, Other, Other, Other, Ampersand, SingleQuote, // 0x20  !"#$%&'
+    Other,  Other,  Other,  Other,  Other,  Other,  Other,  Other,      // 0x28
+    Other,  Other,  Other,  Other,  Other,  Other,  Other,  Other,      // 0x30
+    Other,  Other,  Other,  Semicolon, Less, Other, Greater, Other,     // 0x38  :;<=>?
+    Other,  Other,  Other,  Other,  Other,  Other,  Other,  Other,      // 0x40
+    Other,  Other,  Other,  Other,  Other,  Other,  Other,  Other,      // 0x48
+    Other,  Other,  Other,  Other,  Other,  Other,  Other,  Other,      // 0x50
+    Other,  Other,  Other,  Other,  Backslash, Other, Other, Other,     // 0x58  [\]^_
+    Other,  Other,  Other,  Other,  Other,  Other,  Other,  Other,      // 0x60
+    Other,  Other,  Other,  Other,  Other,  Other,  Other,  Other,      // 0x68
+    Other,  Other,  Other,  Other,  Other,  Other,  Other,  Other,      // 0x70
+    Other,  Other,  Other,  Other,  Pipe,   Other,  Other,  Other       // 0x78  {|}~
+};
+
+#define T(next, action) {next, action}
+#define START_ROW(end) \
+    T(Start, end), T(Start, end|BeginOp|EndAfter), T(InWord, end|Begin), \
+    T(InSingleQuotes, end|Begin), T(InDoubleQuotes, end|Begin), T(AfterBackslash, end|Begin), \
+    T(Start, end|BeginOp|EndAfter), T(AfterPipe, end|BeginOp), T(AfterAmpersand, end|BeginOp), \
+    T(Start, end|BeginOp|EndAfter), T(AfterGreater, end|BeginOp)
+#define ROW(s) \
+    T(s, 0), T(s, 0), T(s, 0), T(s, 0), T(s, 0), T(s, 0), T(s, 0), T(s, 0), T(s, 0), T(s, 0), T(s, 0)
+
+const Transition transitions[NumStates][NumCharClasses] = {
+    // Blank, Newline, Other, SingleQuote, DoubleQuote, Backslash, Semicolon, Pipe, Ampersand, Less, Greater
+    /* Start */ {START_ROW(0)},
+    /* InWord */ {
+        T(Start, End), T(Start, End|BeginOp|EndAfter), T(InWord, 0),
+        T(InSingleQuotes, 0), T(InDoubleQuotes, 0), T(AfterBackslash, 0),
+        T(Start, End|BeginOp|EndAfter), T(AfterPipe, End|BeginOp), T(AfterAmpersand, End|BeginOp),
+        T(Start, End|BeginOp|EndAfter), T(AfterGreater, End|BeginOp)},
+    /* InSingleQuotes */ {
+        T(InSingleQuotes, 0), T(InSingleQuotes, 0), T(InSingleQuotes, 0),
+        T(InWord, 0), T(InSingleQuotes, 0), T(InSingleQuotes, 0),
+        T(InSingleQuotes, 0), T(InSingleQuotes, 0), T(InSingleQuotes, 0),
+        T(InSingleQuotes, 0), T(InSingleQuotes, 0)},
+    /* InDoubleQuotes */ {
+        T(InDoubleQuotes, 0), T(InDoubleQuotes, 0), T(InDoubleQuotes, 0),
+        T(InDoubleQuotes, 0), T(InWord, 0), T(AfterBackslashInDoubleQuotes, 0),
+        T(InDoubleQuotes, 0), T(InDoubleQuotes, 0), T(InDoubleQuotes, 0),
+        T(InDoubleQuotes, 0), T(InDoubleQuotes, 0)},
+    /* AfterBackslash */ {ROW(InWord)},
+    /* AfterBackslashInDoubleQuotes */ {ROW(InDoubleQuotes)},
+    /* AfterPipe */ {
+        T(Start, End), T(Start, End|BeginOp|EndAfter), T(InWord, End|Begin),
+        T(InSingleQuotes, End|Begin), T(InDoubleQuotes, End|Begin), T(AfterBackslash, End|Begin),
+        T(Start, End|BeginOp|EndAfter), T(Start, EndAfter), T(AfterAmpersand, End|BeginOp),
+        T(Start, End|BeginOp|EndAfter), T(AfterGreater, End|BeginOp)},
+    /* AfterAmpersand */ {
+        T(Start, End), T(Start, End|BeginOp|EndAfter), T(InWord, End|Begin),
+        T(InSingleQuotes, End|Begin), T(InDoubleQuotes, End|Begin), T(AfterBackslash, End|Begin),
+        T(Start, End|BeginOp|EndAfter), T(AfterPipe, End|BeginOp), T(Start, EndAfter),
+        T(Start, End|BeginOp|EndAfter), T(AfterGreater, End|BeginOp)},
+    /* AfterGreater */ {
+        T(Start, End), T(Start, End|BeginOp|EndAfter), T(InWord, End|Begin),
+        T(InSingleQuotes, End|Begin), T(InDoubleQuotes, End|Begin), T(AfterBackslash, End|Begin),
+        T(Start, End|BeginOp|EndAfter), T(AfterPipe, End|BeginOp), T(AfterAmpersand, End|BeginOp),
+        T(Start, End|BeginOp|EndAfter), T(Start, EndAfter)}
+};
+
+#undef ROW
+#undef START_ROW
+#undef T
+
+} // namespace
+
+QShellCommandTokenizer::ScanState::ScanState()
+    : state_(Start),
+      tokenStart_(0),
+      tokenType_(Word)
+{
+}
+
+QShellCommandTokenizer::QShellCommandTokenizer()
+    : scanned_(-1)
+{
+}
+
+/*!
+ * \brief Append some text to the command, and tokenize it
+ *
+ * The last token may be incomplete, and is added only when the input ends
+ * (with finishInput()) or when a following chunk ends it.
+ */
+void QShellCommandTokenizer::appendInput(const QString &chunk)
+{
+    if(scanned_ < 0)
+    {
+        // the last token of the command may go on in the chunk: scan it
+        // again (tokens start between tokens)
+        input_ = ScanState();
+        scanned_ = command_.length();
+        if(!spans_.isEmpty() && spans_.last().end_ == command_.length())
+        {
+            scanned_ = spans_.last().start_;
+            spans_.removeLast();
+        }
+    }
+    command_.append(chunk);
+    scanned_ = scan(input_, scanned_, INT_MAX, spans_);
+}
+
+/*!
+ * \brief Signal the end of the input fed with appendInput()
+ */
+void QShellCommandTokenizer::finishInput()
+{
+    if(scanned_ < 0) return;
+
+    finish(input_, spans_);
+    scanned_ = -1;
+}
+
+/*!
+ * \brief Check if the command ends outside of quotes and escapes, i.e. if
+ * it is a complete command (as opposed to one continuing on the next line)
+ */
+bool QShellCommandTokenizer::isComplete() const
+{
+    // tokens start between tokens, so the last one can be scanned alone
+    ScanState s;
+    QVector<TokenSpan> tokens;
+    scan(s, spans_.isEmpty() ? 0 : spans_.last().start_, INT_MAX, tokens);
+    return s.state_ != InSingleQuotes
+            && s.state_ != InDoubleQuotes
+            && s.state_ != AfterBackslash
+            && s.state_ != AfterBackslashInDoubleQuotes;
+}
+
+/*!
+ * \brief Return the value of a word, with quotes and escapes removed
+ */
+QString QShellCommandTokenizer::unquote(QStringView word)
+{
+    QString result;
+    result.reserve(word.length());
+    QChar quote;
+    for(int i = 0; i < word.length(); i++)
+    {
+        QChar c = word.at(i);
+        if(quote == '\'')
+        {
+            if(c == '\'') quote = QChar();
+            else result.append(c);
+        }
+        else if(c == '\\' && i + 1 < word.length())
+        {
+            QChar d = word.at(++i);
+            if(quote == '"' && d != '"' && d != '\\'
+                    && d != '$' && d != '`' && d != '\n')
+                result.append(c);
+            if(d != '\n')
+                result.append(d);
+        }
+        else if(quote == '"')
+        {
+            if(c == '"') quote = QChar();
+            else result.append(c);
+        }
+        else if(c == '\'' || c == '"')
+            quote = c;
+        else
+            result.append(c);
+    }
+    return result;
+}
+
+void QShellCommandTokenizer::tokenize()
+{
+    ScanState s;
+    scan(s, 0, INT_MAX, spans_);
+    finish(s, spans_);
+}
+
+int QShellCommandTokenizer::tokenizeRange(int from, int until, QVector<TokenSpan> &tokens) const
+{
+    ScanState s;
+    int stop = scan(s, from, until, tokens);
+    if(stop == command_.length())
+        finish(s, tokens);
+    return stop;
+}
+
+/*
+ * Run the state machine from position from to the end of the command, or
+ * until it is between tokens at a position not before until.
+ */
+int QShellCommandTokenizer::scan(ScanState &s, int from, int until, QVector<TokenSpan> &tokens) const
+{
+    const QChar *data = command_.constData();
+    int n = command_.length();
+    int state = s.state_;
+    for(int i = from; i < n; i++)
+    {
+        if(state == Start && i >= until)
+        {
+            s.state_ = state;
+            return i;
+        }
+
+        ushort u = data[i].unicode();
+        const Transition &t = transitions[state][u < 128 ? charClass[u] : Other];
+        if(t.action_)
+        {
+            TokenSpan span;
+            span.type_ = s.tokenType_;
+            span.start_ = s.tokenStart_;
+            if(t.action_ & End)
+            {
+                span.end_ = i;
+                tokens.append(span);
+            }
+            if(t.action_ & (Begin | BeginOp))
+            {
+                span.start_ = s.tokenStart_ = i;
+                span.type_ = s.tokenType_ = (t.action_ & BeginOp) ? Operator : Word;
+            }
+            if(t.action_ & EndAfter)
+            {
+                span.end_ = i + 1;
+                tokens.append(span);
+            }
+        }
+        state = t.next_;
+    }
+    s.state_ = state;
+    return n;
+}
+
+void QShellCommandTokenizer::commandChanged()
+{
+    // (applyEdit() needs all the tokens)
+    finishInput();
+}
+
+void QShellCommandTokenizer::finish(ScanState &s, QVector<TokenSpan> &tokens) const
+{
+    if(s.state_ != Start)
+    {
+        TokenSpan span;
+        span.type_ = s.tokenType_;
+        span.start_ = s.tokenStart_;
+        span.end_ = command_.length();
+        tokens.append(span);
+    }
+    s = ScanState();
+}
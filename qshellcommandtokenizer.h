@@ -0,0 +1,78 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef QSHELLCOMMANDTOKENIZER_H
+#define QSHELLCOMMANDTOKENIZER_H
+
+#include "qcommandtokenizer.h"
+
+/*!
+ * \brief A tokenizer following the shell quoting rules
+ *
+ * Words may contain single-quoted and double-quoted strings and backslash
+ * escapes (a quoted blank doesn't split the word); the operators ; | || &
+ * && < > >> and newlines are tokens of their own, with type Operator. Token
+ * text is the raw text of the command (quotes included); unquote() gives
+ * the value of a word.
+ *
+ * The command is scanned once by a table-driven state machine, so input can
+ * also be fed in chunks with appendInput() as it arrives (e.g. a large
+ * paste), followed by finishInput(); setCommand(), applyEdit() and clear()
+ * end the input too. Input appended after that continues the command, and
+ * its last token.
+ */
+class QShellCommandTokenizer : public QCommandTokenizer
+{
+public:
+    enum TokenType
+    {
+        Word = 0,
+        Operator = 1
+    };
+
+    QShellCommandTokenizer();
+
+    void appendInput(const QString &chunk);
+    void finishInput();
+    bool isComplete() const;
+
+    static QString unquote(QStringView word);
+
+protected:
+    void tokenize();
+    int tokenizeRange(int from, int until, QVector<TokenSpan> &tokens) const;
+    void commandChanged();
+
+private:
+    struct ScanState
+    {
+        int state_;
+        int tokenStart_;
+        int tokenType_;
+
+        ScanState();
+    };
+
+    int scan(ScanState &s, int from, int until, QVector<TokenSpan> &tokens) const;
+    void finish(ScanState &s, QVector<TokenSpan> &tokens) const;
+
+    // state of the input fed with appendInput(); scanned_ is -1 between
+    // inputs
+    ScanState input_;
+    int scanned_;
+};
+
+#endif // QSHELLCOMMANDTOKENIZER_H
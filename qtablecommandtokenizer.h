@@ -0,0 +1,152 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef QTABLECOMMANDTOKENIZER_H
+#define QTABLECOMMANDTOKENIZER_H
+
+#include "qcommandtokenizer.h"
+
+/*!
+ * \brief Character class of QSimpleCommandTokenizer: tokens are separated by
+ * blanks
+ *
+ * A character class for QTableCommandTokenizer must provide
+ * isSeparator(int c), a constexpr function for c < 256 (used for building
+ * the lookup table at compile time), and isSeparator(QChar c) for the other
+ * characters.
+ */
+struct QBlankCharClass
+{
+    static constexpr bool isSeparator(int c)
+    {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+    }
+
+    static bool isSeparator(QChar c)
+    {
+        Q_UNUSED(c);
+        return false;
+    }
+};
+
+namespace QCommandTokenizerPrivate {
+
+template<int... I> struct Indices {};
+template<int N, int... I> struct MakeIndices : MakeIndices<N - 1, N - 1, I...> {};
+template<int... I> struct MakeIndices<0, I...> { typedef Indices<I...> type; };
+
+template<typename CharClass, typename Indices> struct Table;
+template<typename CharClass, int... I> struct Table<CharClass, Indices<I...> >
+{
+    static constexpr bool separator_[sizeof...(I)] = {CharClass::isSeparator(I)...};
+};
+template<typename CharClass, int... I>
+constexpr bool Table<CharClass, Indices<I...> >::separator_[sizeof...(I)];
+
+// highest separator below 128 (or -1), computed at compile time
+template<typename CharClass>
+constexpr int maxAsciiSeparator(int c = 127)
+{
+    return c < 0 ? -1 : CharClass::isSeparator(c) ? c : maxAsciiSeparator<CharClass>(c - 1);
+}
+
+// skip blocks of 8 characters which are all ASCII above maxSep (SSE2 only)
+int skipAboveAscii(const QChar *data, int i, int n, int maxSep);
+
+} // namespace QCommandTokenizerPrivate
+
+/*!
+ * \brief A tokenizer splitting the command at separators defined by a
+ * character class given at compile time
+ *
+ * Separators below 256 are looked up in a table built at compile time, and
+ * other characters are checked with CharClass::isSeparator(QChar). Inside
+ * tokens, the command is scanned 8 characters at a time (if SSE2 is
+ * available) skipping the characters which can't be separators: ASCII
+ * characters above the highest ASCII separator.
+ *
+ * QTableCommandTokenizer<> splits tokens like QSimpleCommandTokenizer,
+ * without a virtual call per character.
+ */
+template<typename CharClass = QBlankCharClass>
+class QTableCommandTokenizer : public QCommandTokenizer
+{
+public:
+    static bool isSeparator(QChar c)
+    {
+        return c.unicode() < 256 ? Table::separator_[c.unicode()] : CharClass::isSeparator(c);
+    }
+
+protected:
+    void tokenize()
+    {
+        tokenizeRange(0, command_.length(), spans_);
+    }
+
+    int tokenizeRange(int from, int until, QVector<TokenSpan> &tokens) const
+    {
+        const QChar *data = command_.constData();
+        int n = command_.length();
+        int i = from;
+        while(true)
+        {
+            // skip separators
+            while(i < n && isSeparator(data[i]))
+            {
+                if(i >= until)
+                    return i;
+                i++;
+            }
+            if(i == n)
+                return n;
+
+            // token
+            TokenSpan t;
+            t.type_ = 0;
+            t.start_ = i;
+            i = findSeparator(data, i + 1, n);
+            t.end_ = i;
+            tokens.append(t);
+            if(i >= until)
+                return i;
+        }
+    }
+
+private:
+    typedef QCommandTokenizerPrivate::Table<CharClass, typename QCommandTokenizerPrivate::MakeIndices<256>::type> Table;
+
+    // (a constant expression, so that it is never computed at run time)
+    static constexpr int maxSeparator_ = QCommandTokenizerPrivate::maxAsciiSeparator<CharClass>();
+
+    static int findSeparator(const QChar *data, int i, int n)
+    {
+        while(true)
+        {
+            i = QCommandTokenizerPrivate::skipAboveAscii(data, i, n, maxSeparator_);
+            int blockEnd = qMin(i + 8, n);
+            for(; i < blockEnd; i++)
+                if(isSeparator(data[i]))
+                    return i;
+            if(i >= n)
+                return n;
+        }
+    }
+};
+
+template<typename CharClass>
+constexpr int QTableCommandTokenizer<CharClass>::maxSeparator_;
+
+#endif // QTABLECOMMANDTOKENIZER_H
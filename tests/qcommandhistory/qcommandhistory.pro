@@ -0,0 +1,15 @@
+# QCommandEdit - a command input widget with history and tab completion
+# Copyright (C) 2018 Federico Ferri
+
+QT += testlib widgets concurrent
+
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_qcommandhistory
+TEMPLATE = app
+
+include(../../qcommandedit.pri)
+
+SOURCES += \
+    tst_qcommandhistory.cpp
@@ -0,0 +1,531 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QtTest>
+
+#include "qcommandhistory.h"
+#include "qcommandhistoryindex.h"
+#include "qcommandhistorystorage.h"
+
+// the text of the entries indexed by a QCommandHistoryIndex: ref i is the
+// i-th entry, encoded as Latin-1 when possible
+class TextList : public QCommandHistoryIndex::TextSource
+{
+public:
+    void append(const QString &entry)
+    {
+        bool utf8 = false;
+        for(QChar c : entry)
+            utf8 = utf8 || c.unicode() > 0xFF;
+        bytes_.append(utf8 ? entry.toUtf8() : entry.toLatin1());
+        utf8_.append(utf8);
+    }
+
+    const char * text(quint32 ref, int *size, bool *utf8) const
+    {
+        *size = bytes_.at(int(ref)).size();
+        *utf8 = utf8_.at(int(ref));
+        return bytes_.at(int(ref)).constData();
+    }
+
+private:
+    QVector<QByteArray> bytes_;
+    QVector<bool> utf8_;
+};
+
+class tst_QCommandHistory : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void removeAndIds();
+    void purgeRemoved();
+    void capacity();
+    void adoptIndex();
+    void adoptIndexOfOlderSnapshot();
+    void storageInterning();
+    void indexNonAscii_data();
+    void indexNonAscii();
+    void randomOperations_data();
+    void randomOperations();
+
+private:
+    static QStringList entries(const QCommandHistory &history);
+    static QVector<int> ids(const QCommandHistory &history);
+    static void compareSearches(const QCommandHistory &history, const QStringList &expected, QCommandHistory::Cursor &cursor, quint32 &state);
+};
+
+// deterministic pseudo-random numbers (xorshift)
+static quint32 nextRandom(quint32 &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// short entries over a few ASCII, Latin-1 and other chars, so that many of
+// them share prefixes
+static QString randomEntry(quint32 &state)
+{
+    static const ushort chars[] = {'a', 'b', ' ', 0xE9, 0xE8, 0x20AC, 0x65E5};
+    QString entry;
+    int length = 1 + int(nextRandom(state) % 5);
+    for(int i = 0; i < length; i++)
+        entry += QChar(chars[nextRandom(state) % 7]);
+    return entry;
+}
+
+QStringList tst_QCommandHistory::entries(const QCommandHistory &history)
+{
+    QStringList result;
+    for(int i = 0; i < history.count(); i++)
+        result << history.at(i);
+    return result;
+}
+
+QVector<int> tst_QCommandHistory::ids(const QCommandHistory &history)
+{
+    QVector<int> result;
+    for(int i = 0; i < history.count(); i++)
+        result << history.idAt(i);
+    return result;
+}
+
+void tst_QCommandHistory::removeAndIds()
+{
+    QCommandHistory history;
+    history.set(QStringList({"a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7", "a8", "a9"}));
+    int revision = history.revision();
+
+    history.remove(3);
+    QCOMPARE(history.count(), 9);
+    QCOMPARE(history.at(3), QString("a4"));
+    QCOMPARE(history.idAt(2), 2);
+    QCOMPARE(history.idAt(3), 4);
+    QCOMPARE(history.idAt(history.count()), 10);
+    QCOMPARE(history.indexOf(3), -1);
+    QCOMPARE(history.indexOf(4), 3);
+    QCOMPARE(history.lowerBound(3), 3);
+    QCOMPARE(history.lowerBound(10), history.count());
+
+    // removing the oldest entry drops it
+    history.remove(0);
+    QCOMPARE(history.firstId(), 1);
+    QCOMPARE(history.idAt(0), 1);
+    QCOMPARE(history.indexOf(0), -1);
+    QCOMPARE(history.lowerBound(0), 0);
+
+    // out of range: nothing happens
+    history.remove(-1);
+    history.remove(history.count());
+    QCOMPARE(entries(history), QStringList({"a1", "a2", "a4", "a5", "a6", "a7", "a8", "a9"}));
+    QCOMPARE(ids(history), QVector<int>({1, 2, 4, 5, 6, 7, 8, 9}));
+
+    // the ids did not change, nor the revision
+    QCOMPARE(history.revision(), revision);
+    QCOMPARE(history.matchingIds("a"), QVector<int>({1, 2, 4, 5, 6, 7, 8, 9}));
+}
+
+void tst_QCommandHistory::purgeRemoved()
+{
+    QCommandHistory history;
+    history.set(QStringList({"a0", "a1", "a2", "a3", "a4", "a5", "a6", "a7", "a8", "a9"}));
+    history.updateIndex();
+    int revision = history.revision();
+
+    // removed entries outnumbering the others are purged, and the entries
+    // renumbered
+    for(int i = 0; i < 5; i++)
+        history.remove(i + 1);
+    QCOMPARE(history.revision(), revision);
+    history.remove(2);
+    QVERIFY(history.revision() != revision);
+    QCOMPARE(entries(history), QStringList({"a0", "a2", "a6", "a8"}));
+    QCOMPARE(history.firstId(), 0);
+    QCOMPARE(ids(history), QVector<int>({0, 1, 2, 3}));
+    QCOMPARE(history.indexOf(3), 3);
+    QCOMPARE(history.indexOf(4), -1);
+
+    // the index is rebuilt
+    QCOMPARE(history.unindexedCount(), 4);
+    QCOMPARE(history.matchingIds("a"), QVector<int>({0, 1, 2, 3}));
+    history.updateIndex();
+    QCOMPARE(history.matchingIds("a8"), QVector<int>({3}));
+}
+
+void tst_QCommandHistory::capacity()
+{
+    QCommandHistory history;
+    QStringList all;
+    for(int i = 0; i < 10; i++)
+        all << QString("c%1").arg(i);
+    history.set(all);
+    history.updateIndex();
+    int revision = history.revision();
+
+    // the oldest entries are dropped, ids do not change
+    history.setCapacity(8);
+    QCOMPARE(history.capacity(), 8);
+    QCOMPARE(history.count(), 8);
+    QCOMPARE(history.firstId(), 2);
+    QCOMPARE(history.at(0), QString("c2"));
+    QCOMPARE(history.indexOf(1), -1);
+    QCOMPARE(history.indexOf(2), 0);
+    QCOMPARE(history.revision(), revision);
+    QCOMPARE(history.matchingIds("c"), QVector<int>({2, 3, 4, 5, 6, 7, 8, 9}));
+
+    // once the dropped entries outnumber the others, the storage is
+    // compacted and the index rebuilt; ids still do not change
+    history.setCapacity(3);
+    QCOMPARE(entries(history), QStringList({"c7", "c8", "c9"}));
+    QCOMPARE(ids(history), QVector<int>({7, 8, 9}));
+    QVERIFY(history.revision() != revision);
+    QCOMPARE(history.unindexedCount(), 3);
+    QCOMPARE(history.matchingIds("c"), QVector<int>({7, 8, 9}));
+
+    history.append("c10");
+    QCOMPARE(entries(history), QStringList({"c8", "c9", "c10"}));
+    QCOMPARE(history.idAt(2), 10);
+    QCOMPARE(history.matchingIds("c1"), QVector<int>({10}));
+
+    // removed entries do not count
+    history.remove(1);
+    history.append("c11");
+    QCOMPARE(entries(history), QStringList({"c8", "c10", "c11"}));
+
+    // no limit
+    history.setCapacity(0);
+    for(int i = 0; i < 5; i++)
+        history.append("d");
+    QCOMPARE(history.count(), 8);
+}
+
+void tst_QCommandHistory::adoptIndex()
+{
+    // more entries than append() indexes in place
+    QStringList all;
+    for(int i = 0; i < 3 * QCommandHistory::IndexInPlaceLimit; i++)
+        all << QString("e%1").arg(i);
+    QCommandHistory history;
+    history.set(all);
+    QCOMPARE(history.unindexedCount(), all.size());
+
+    // the index is built on a snapshot (as in a background thread) while
+    // the history is modified
+    QCommandHistory snapshot = history.snapshot();
+    snapshot.updateIndex();
+    QCOMPARE(snapshot.unindexedCount(), 0);
+    history.append("e-new");
+    history.remove(5);
+    QCOMPARE(history.unindexedCount(), all.size() + 1);
+
+    QVERIFY(history.adoptIndex(snapshot));
+    QCOMPARE(history.unindexedCount(), 1);
+    QCOMPARE(history.indexMemoryUsage(), snapshot.indexMemoryUsage());
+    QCommandHistory::Cursor cursor;
+    QCOMPARE(history.mostRecentMatch(cursor, "e5"), entries(history).lastIndexOf("e599"));
+    QCOMPARE(history.mostRecentMatch(cursor, "e-"), history.count() - 1);
+    QVERIFY(!history.matchingIds("e5").contains(5));
+
+    // the snapshot is not affected
+    QCOMPARE(snapshot.count(), all.size());
+    QCOMPARE(snapshot.at(5), QString("e5"));
+
+    // an index with no more entries than the history's is not taken
+    history.updateIndex();
+    QVERIFY(!history.adoptIndex(snapshot));
+    QCOMPARE(history.unindexedCount(), 0);
+}
+
+void tst_QCommandHistory::adoptIndexOfOlderSnapshot()
+{
+    QStringList all;
+    for(int i = 0; i < 2 * QCommandHistory::IndexInPlaceLimit; i++)
+        all << QString("f%1").arg(i % 10);
+    QCommandHistory history;
+    history.set(all);
+
+    // entries dropped since the snapshot stay out of the results
+    QCommandHistory snapshot = history.snapshot();
+    snapshot.updateIndex();
+    history.setCapacity(all.size() - 100);
+    QVERIFY(history.adoptIndex(snapshot));
+    QCOMPARE(history.unindexedCount(), 0);
+    QVector<int> expected;
+    for(int i = 0; i < history.count(); i++)
+        if(history.at(i) == QLatin1String("f3"))
+            expected << history.idAt(i);
+    QCOMPARE(history.matchingIds("f3"), expected);
+
+    // once the entries are renumbered, the index of an older snapshot does
+    // not apply
+    snapshot = history.snapshot();
+    snapshot.updateIndex();
+    while(history.revision() == snapshot.revision())
+        history.remove(history.count() - 1);
+    QVERIFY(!history.adoptIndex(snapshot));
+    QCOMPARE(history.unindexedCount(), history.count());
+    QCommandHistory::Cursor cursor;
+    QCOMPARE(history.mostRecentMatch(cursor, "f9"), entries(history).lastIndexOf("f9"));
+}
+
+void tst_QCommandHistory::storageInterning()
+{
+    // "â\u0082¬" in Latin-1 has the same bytes as "€" in UTF-8
+    QString latin1 = QString::fromUtf8("café");
+    QString utf8 = QString::fromUtf8("caf€");
+    QString latin1Bytes = QString::fromLatin1("\xe2\x82\xac");
+    QString euro = QString::fromUtf8("€");
+    QStringList appended({latin1, "ls", latin1, utf8, latin1Bytes, euro, utf8, euro, latin1Bytes, "ls"});
+
+    QCommandHistoryStorage storage;
+    for(const QString &entry : appended)
+        storage.append(entry);
+    QCOMPARE(storage.count(), appended.size());
+    QCOMPARE(storage.uniqueCount(), 5);
+    for(int i = 0; i < appended.size(); i++)
+        QCOMPARE(storage.at(i), appended.at(i));
+
+    // duplicates share the text, whatever the encoding
+    QCOMPARE(storage.uniqueAt(2), storage.uniqueAt(0));
+    QCOMPARE(storage.uniqueAt(6), storage.uniqueAt(3));
+    QCOMPARE(storage.uniqueAt(7), storage.uniqueAt(5));
+    QCOMPARE(storage.uniqueAt(8), storage.uniqueAt(4));
+    QVERIFY(storage.uniqueAt(4) != storage.uniqueAt(5));
+
+    int size;
+    bool isUtf8;
+    const char *data = storage.uniqueData(storage.uniqueAt(0), &size, &isUtf8);
+    QVERIFY(!isUtf8);
+    QCOMPARE(QByteArray(data, size), latin1.toLatin1());
+    data = storage.uniqueData(storage.uniqueAt(3), &size, &isUtf8);
+    QVERIFY(isUtf8);
+    QCOMPARE(QByteArray(data, size), utf8.toUtf8());
+    data = storage.uniqueData(storage.uniqueAt(4), &size, &isUtf8);
+    QVERIFY(!isUtf8);
+    QCOMPARE(QByteArray(data, size), QByteArray("\xe2\x82\xac"));
+
+    // a copy is not affected by later appends, and interns on its own
+    QCommandHistoryStorage copy = storage;
+    storage.append("new");
+    copy.append(euro);
+    QCOMPARE(storage.count(), appended.size() + 1);
+    QCOMPARE(storage.at(appended.size()), QString("new"));
+    QCOMPARE(copy.count(), appended.size() + 1);
+    QCOMPARE(copy.uniqueCount(), 5);
+    QCOMPARE(copy.at(appended.size()), euro);
+
+    // removing entries keeps the others
+    storage.removeFirst();
+    storage.removeFirst();
+    QCOMPARE(storage.at(0), latin1);
+    storage.append(latin1);
+    QCOMPARE(storage.uniqueCount(), 6);
+}
+
+void tst_QCommandHistory::indexNonAscii_data()
+{
+    QTest::addColumn<QString>("prefix");
+    QTest::addColumn<QVector<int> >("ids");
+
+    // entries: 0 café, 1 cafè, 2 caf€, 3 日本語, 4 日本, 5 été, 6 café noir
+    QTest::newRow("ascii") << QString("caf") << QVector<int>({0, 1, 2, 6});
+    QTest::newRow("latin-1") << QString::fromUtf8("café") << QVector<int>({0, 6});
+    QTest::newRow("latin-1 and more") << QString::fromUtf8("café ") << QVector<int>({6});
+    QTest::newRow("utf-8") << QString::fromUtf8("caf€") << QVector<int>({2});
+    QTest::newRow("cjk") << QString::fromUtf8("日") << QVector<int>({3, 4});
+    QTest::newRow("cjk whole") << QString::fromUtf8("日本語") << QVector<int>({3});
+    QTest::newRow("latin-1 first") << QString::fromUtf8("é") << QVector<int>({5});
+    QTest::newRow("no match") << QString::fromUtf8("cafê") << QVector<int>();
+    QTest::newRow("longer than entry") << QString::fromUtf8("日本語!") << QVector<int>();
+}
+
+void tst_QCommandHistory::indexNonAscii()
+{
+    QFETCH(QString, prefix);
+    QFETCH(QVector<int>, ids);
+
+    TextList text;
+    QCommandHistoryIndex index;
+    QStringList all({QString::fromUtf8("café"), QString::fromUtf8("cafè"), QString::fromUtf8("caf€"),
+                     QString::fromUtf8("日本語"), QString::fromUtf8("日本"), QString::fromUtf8("été"),
+                     QString::fromUtf8("café noir")});
+    for(int i = 0; i < all.size(); i++)
+    {
+        text.append(all.at(i));
+        index.insert(quint32(i), i, text);
+    }
+
+    QCommandHistoryIndex::Cursor cursor;
+    index.seek(cursor, prefix.toUtf8(), text);
+    QCOMPARE(index.matches(cursor), ids);
+    QCOMPARE(index.mostRecent(cursor), ids.isEmpty() ? -1 : ids.last());
+
+    // narrowing one UTF-8 byte at a time (also inside a char) gives the
+    // same result
+    QByteArray utf8 = prefix.toUtf8();
+    QCommandHistoryIndex::Cursor incremental;
+    for(int i = 0; i <= utf8.size(); i++)
+    {
+        index.seek(incremental, utf8.left(i), text);
+        QVector<int> expected;
+        for(int j = 0; j < all.size(); j++)
+            if(all.at(j).toUtf8().startsWith(utf8.left(i)))
+                expected << j;
+        QCOMPARE(index.matches(incremental), expected);
+    }
+
+    // and so does widening back
+    index.seek(incremental, utf8.left(utf8.size() / 2), text);
+    index.seek(incremental, utf8, text);
+    QCOMPARE(index.matches(incremental), ids);
+}
+
+void tst_QCommandHistory::randomOperations_data()
+{
+    QTest::addColumn<quint32>("seed");
+    QTest::addColumn<int>("capacity");
+
+    QTest::newRow("no capacity, seed 1") << 2463534242u << 0;
+    QTest::newRow("no capacity, seed 2") << 88675123u << 0;
+    QTest::newRow("capacity 50, seed 1") << 2463534242u << 50;
+    QTest::newRow("capacity 50, seed 2") << 123456789u << 50;
+    QTest::newRow("capacity 1500, seed 3") << 521288629u << 1500;
+}
+
+/*
+ * Append, remove, evict and index entries in random order, with snapshots
+ * being taken (leaving entries unindexed) and their index adopted later,
+ * and compare every result with a linear scan of the entries.
+ */
+void tst_QCommandHistory::randomOperations()
+{
+    QFETCH(quint32, seed);
+    QFETCH(int, capacity);
+
+    quint32 state = seed;
+    QCommandHistory history;
+    history.setCapacity(capacity);
+    QStringList expected;
+    QCommandHistory::Cursor cursor;
+    QCommandHistory shared; // a snapshot sharing the index, or an empty history
+    QCommandHistory indexed; // a snapshot with an updated index
+
+    for(int step = 0; step < 3000; step++)
+    {
+        QVector<int> oldIds = ids(history);
+        int oldRevision = history.revision();
+        int nextId = history.idAt(history.count());
+
+        quint32 op = nextRandom(state) % 100;
+        if(op < 70)
+        {
+            QString entry = randomEntry(state);
+            history.append(entry);
+            expected << entry;
+            oldIds << nextId;
+        }
+        else if(op < 85 && !expected.isEmpty())
+        {
+            int i = int(nextRandom(state) % quint32(expected.size()));
+            history.remove(i);
+            expected.removeAt(i);
+            oldIds.removeAt(i);
+        }
+        else if(op < 90)
+        {
+            history.updateIndex();
+            QCOMPARE(history.unindexedCount(), 0);
+        }
+        else if(op < 94)
+        {
+            shared = nextRandom(state) % 2 ? history.snapshot() : QCommandHistory();
+        }
+        else if(op < 97)
+        {
+            indexed = history.snapshot();
+            indexed.updateIndex();
+        }
+        else
+        {
+            history.adoptIndex(indexed);
+        }
+        while(capacity > 0 && expected.size() > capacity)
+        {
+            expected.removeFirst();
+            oldIds.removeFirst();
+        }
+
+        QCOMPARE(history.count(), expected.size());
+        if(history.revision() == oldRevision)
+            QCOMPARE(ids(history), oldIds);
+        if(step % 10 == 0 || step > 2950)
+            compareSearches(history, expected, cursor, state);
+        if(QTest::currentTestFailed())
+            QFAIL(qPrintable(QString("at step %1").arg(step)));
+    }
+}
+
+void tst_QCommandHistory::compareSearches(const QCommandHistory &history, const QStringList &expected, QCommandHistory::Cursor &cursor, quint32 &state)
+{
+    QCOMPARE(entries(history), expected);
+    QVector<int> allIds = ids(history);
+    for(int i = 0; i < allIds.size(); i++)
+    {
+        QCOMPARE(history.indexOf(allIds.at(i)), i);
+        QCOMPARE(history.lowerBound(allIds.at(i)), i);
+        if(i > 0 && allIds.at(i) > allIds.at(i - 1) + 1)
+            QCOMPARE(history.indexOf(allIds.at(i) - 1), -1);
+    }
+
+    // typing an entry one char at a time, with the cursor kept across
+    // modifications (as the widget does), and with a new cursor
+    QString target = randomEntry(state);
+    for(int length = 1; length <= target.length(); length++)
+    {
+        QString prefix = target.left(length);
+        QVector<int> matches;
+        for(int i = 0; i < expected.size(); i++)
+            if(expected.at(i).startsWith(prefix))
+                matches << i;
+
+        QCOMPARE(history.mostRecentMatch(cursor, prefix), matches.isEmpty() ? -1 : matches.last());
+        QCommandHistory::Cursor newCursor;
+        QCOMPARE(history.mostRecentMatch(newCursor, prefix), matches.isEmpty() ? -1 : matches.last());
+
+        QVector<int> matchIds;
+        for(int i : matches)
+            matchIds << allIds.at(i);
+        QCOMPARE(history.matchingIds(prefix), matchIds);
+
+        int pos = int(nextRandom(state) % quint32(expected.size() + 2)) - 1;
+        int previous = -1, next = -1;
+        for(int i : matches)
+        {
+            if(i < pos)
+                previous = i;
+            if(i > pos && next == -1)
+                next = i;
+        }
+        QCOMPARE(history.previousMatch(prefix, pos), previous);
+        QCOMPARE(history.nextMatch(prefix, pos), next);
+    }
+}
+
+QTEST_GUILESS_MAIN(tst_QCommandHistory)
+
+#include "tst_qcommandhistory.moc"
@@ -0,0 +1,15 @@
+# QCommandEdit - a command input widget with history and tab completion
+# Copyright (C) 2018 Federico Ferri
+
+QT += testlib widgets concurrent
+
+CONFIG += c++11 console testcase
+CONFIG -= app_bundle
+
+TARGET = tst_qcommandhistoryjournal
+TEMPLATE = app
+
+include(../../qcommandedit.pri)
+
+SOURCES += \
+    tst_qcommandhistoryjournal.cpp
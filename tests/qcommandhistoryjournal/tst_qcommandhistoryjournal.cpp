@@ -0,0 +1,130 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QtTest>
+
+#include "qcommandhistoryjournal.h"
+
+class tst_QCommandHistoryJournal : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void appendAndRead();
+    void tornLastRecord();
+    void refuseNonJournal_data();
+    void refuseNonJournal();
+
+private:
+    static QByteArray readFile(const QString &fileName);
+    static void writeFile(const QString &fileName, const QByteArray &content);
+};
+
+QByteArray tst_QCommandHistoryJournal::readFile(const QString &fileName)
+{
+    QFile f(fileName);
+    if(!f.open(QIODevice::ReadOnly))
+        return QByteArray();
+    return f.readAll();
+}
+
+void tst_QCommandHistoryJournal::writeFile(const QString &fileName, const QByteArray &content)
+{
+    QFile f(fileName);
+    QVERIFY(f.open(QIODevice::WriteOnly));
+    QCOMPARE(f.write(content), qint64(content.size()));
+}
+
+void tst_QCommandHistoryJournal::appendAndRead()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString fileName = dir.filePath("history.journal");
+
+    QCommandHistoryJournal journal;
+    QVERIFY(journal.open(fileName));
+    journal.append("ls");
+    journal.append("cd /tmp");
+    journal.close();
+
+    // reopening appends to the existing records
+    QVERIFY(journal.open(fileName));
+    journal.append("echo è");
+    journal.close();
+
+    QCOMPARE(QCommandHistoryJournal::read(fileName), QStringList({"ls", "cd /tmp", "echo è"}));
+}
+
+void tst_QCommandHistoryJournal::tornLastRecord()
+{
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString fileName = dir.filePath("history.journal");
+
+    QCommandHistoryJournal journal;
+    QVERIFY(journal.open(fileName));
+    journal.append("ls");
+    journal.append("make all");
+    journal.append("git status");
+    journal.close();
+
+    // a crash in the middle of the last record:
+    QByteArray content = readFile(fileName);
+    writeFile(fileName, content.left(content.size() - 3));
+
+    qint64 validSize = 0;
+    QCOMPARE(QCommandHistoryJournal::read(fileName, &validSize), QStringList({"ls", "make all"}));
+    QCOMPARE(validSize, qint64(content.size() - 8 - 10)); // (the record of "git status")
+
+    // the torn record is dropped when reopening, the others are kept:
+    QVERIFY(journal.open(fileName));
+    QCOMPARE(QFileInfo(fileName).size(), validSize);
+    journal.append("pwd");
+    journal.close();
+
+    QCOMPARE(QCommandHistoryJournal::read(fileName), QStringList({"ls", "make all", "pwd"}));
+}
+
+void tst_QCommandHistoryJournal::refuseNonJournal_data()
+{
+    QTest::addColumn<QByteArray>("content");
+    QTest::newRow("text") << QByteArray("ls\ncd /tmp\nmake\n");
+    QTest::newRow("newer version") << QByteArray("QCEJ\x02\0\0\0", 8);
+    QTest::newRow("torn header") << QByteArray("QCE");
+}
+
+void tst_QCommandHistoryJournal::refuseNonJournal()
+{
+    QFETCH(QByteArray, content);
+
+    QTemporaryDir dir;
+    QVERIFY(dir.isValid());
+    QString fileName = dir.filePath("history.journal");
+    writeFile(fileName, content);
+
+    QCommandHistoryJournal journal;
+    QVERIFY(!journal.open(fileName));
+    QVERIFY(!journal.isOpen());
+    QCOMPARE(readFile(fileName), content);
+
+    QVERIFY(!QCommandHistoryJournal::compact(fileName, dir.filePath("history.snapshot")));
+    QCOMPARE(readFile(fileName), content);
+    QVERIFY(!QFile::exists(dir.filePath("history.snapshot")));
+}
+
+QTEST_GUILESS_MAIN(tst_QCommandHistoryJournal)
+
+#include "tst_qcommandhistoryjournal.moc"
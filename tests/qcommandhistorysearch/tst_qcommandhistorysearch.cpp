@@ -0,0 +1,354 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QtTest>
+
+#include "qcommandedit_p.h"
+#include "qcommandhistory.h"
+#include "qcommandhistorysearch.h"
+
+#include <cstring>
+
+#if defined(Q_OS_UNIX)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+/*
+ * The scalar, SSE2 and AVX2 code paths of the history search, each compared
+ * with QString::indexOf() (bytes are compared as Latin-1 strings).
+ */
+class tst_QCommandHistorySearch : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void cleanup();
+    void findBytes_data();
+    void findBytes();
+    void findBytesRandom_data();
+    void findBytesRandom();
+    void findBytesAtPageEnd_data();
+    void findBytesAtPageEnd();
+    void search_data();
+    void search();
+    void narrowAndWiden_data();
+    void narrowAndWiden();
+
+private:
+    static void addSimdLevels();
+    static int expectedIndex(const QByteArray &hay, const QByteArray &needle);
+    static int foundIndex(const QByteArray &hay, const QByteArray &needle);
+    static int expectedMatch(const QStringList &entries, const QString &query, QCommandHistorySearch::Mode mode, int from);
+};
+
+// deterministic pseudo-random numbers (xorshift)
+static quint32 nextRandom(quint32 &state)
+{
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// text over a few ASCII, Latin-1 and other chars, so that queries often
+// match, or almost match
+static QString randomText(quint32 &state, int length)
+{
+    static const ushort chars[] = {'a', 'b', 'c', ' ', 0xE9, 0x20AC};
+    QString text;
+    for(int i = 0; i < length; i++)
+        text += QChar(chars[nextRandom(state) % 6]);
+    return text;
+}
+
+void tst_QCommandHistorySearch::addSimdLevels()
+{
+    QTest::addColumn<int>("simd");
+    QTest::newRow("scalar") << int(QCommandEditScalar);
+    QTest::newRow("sse2") << int(QCommandEditSse2);
+    QTest::newRow("avx2") << int(QCommandEditAvx2);
+}
+
+int tst_QCommandHistorySearch::expectedIndex(const QByteArray &hay, const QByteArray &needle)
+{
+    return QString::fromLatin1(hay).indexOf(QString::fromLatin1(needle));
+}
+
+int tst_QCommandHistorySearch::foundIndex(const QByteArray &hay, const QByteArray &needle)
+{
+    const char *p = qCommandEditFindBytes(hay.constData(), hay.size(), needle.constData(), needle.size());
+    return p ? int(p - hay.constData()) : -1;
+}
+
+int tst_QCommandHistorySearch::expectedMatch(const QStringList &entries, const QString &query, QCommandHistorySearch::Mode mode, int from)
+{
+    for(int i = qMin(from, entries.size()) - 1; i >= 0; i--)
+    {
+        const QString &entry = entries.at(i);
+        if(mode == QCommandHistorySearch::Substring)
+        {
+            if(entry.indexOf(query) >= 0)
+                return i;
+            continue;
+        }
+        int pos = 0;
+        for(QChar c : query)
+        {
+            pos = entry.indexOf(c, pos);
+            if(pos < 0) break;
+            pos++;
+        }
+        if(pos >= 0)
+            return i;
+    }
+    return -1;
+}
+
+void tst_QCommandHistorySearch::cleanup()
+{
+    // back to the best supported instruction set
+    qCommandEditSetSimd(QCommandEditAvx2);
+}
+
+void tst_QCommandHistorySearch::findBytes_data()
+{
+    addSimdLevels();
+}
+
+/*
+ * Needles of 1 to 40 bytes (so, longer than 16 and 32 bytes too) at every
+ * position of haystacks up to 70 bytes longer, so that matches start and
+ * end in every position of a 16 or 32 byte block, and cross blocks; a near
+ * miss (same first and last byte) comes before the match.
+ */
+void tst_QCommandHistorySearch::findBytes()
+{
+    QFETCH(int, simd);
+    if(qCommandEditSetSimd(QCommandEditSimd(simd)) != simd)
+        QSKIP("instruction set not supported");
+
+    for(int m = 1; m <= 40; m++)
+    {
+        QByteArray needle(m, 'n');
+        needle[0] = 'f';
+        needle[m - 1] = '\xe9';
+        QByteArray nearMiss = needle;
+        if(m > 2)
+            nearMiss[m / 2] = 'x';
+
+        for(int n = m; n <= m + 70; n++)
+        {
+            for(int p = 0; p <= n - m; p++)
+            {
+                QByteArray hay(n, 'x');
+                if(m > 2 && p >= m)
+                    hay.replace(p - m, m, nearMiss);
+                hay.replace(p, m, needle);
+                QCOMPARE(foundIndex(hay, needle), expectedIndex(hay, needle));
+            }
+
+            // and no match at all
+            QByteArray hay(n, 'x');
+            if(m > 2)
+                hay.replace(n - m, m, nearMiss);
+            QCOMPARE(foundIndex(hay, needle), expectedIndex(hay, needle));
+        }
+    }
+}
+
+void tst_QCommandHistorySearch::findBytesRandom_data()
+{
+    addSimdLevels();
+}
+
+void tst_QCommandHistorySearch::findBytesRandom()
+{
+    QFETCH(int, simd);
+    if(qCommandEditSetSimd(QCommandEditSimd(simd)) != simd)
+        QSKIP("instruction set not supported");
+
+    static const char bytes[] = {'a', 'b', '\xe9', '\x80'};
+    quint32 state = 2463534242u;
+    for(int iteration = 0; iteration < 20000; iteration++)
+    {
+        QByteArray hay;
+        int n = int(nextRandom(state) % 300);
+        for(int i = 0; i < n; i++)
+            hay += bytes[nextRandom(state) % 4];
+
+        // a part of the haystack (which may occur earlier too), or random
+        // bytes
+        QByteArray needle;
+        int m = 1 + int(nextRandom(state) % 80);
+        if(nextRandom(state) % 2 && m <= n)
+        {
+            needle = hay.mid(int(nextRandom(state) % quint32(n - m + 1)), m);
+        }
+        else
+        {
+            for(int i = 0; i < m; i++)
+                needle += bytes[nextRandom(state) % 4];
+        }
+        QCOMPARE(foundIndex(hay, needle), expectedIndex(hay, needle));
+    }
+}
+
+void tst_QCommandHistorySearch::findBytesAtPageEnd_data()
+{
+    addSimdLevels();
+}
+
+/*
+ * Haystacks ending at the end of a readable page, followed by an unreadable
+ * one: the search must not read past the haystack.
+ */
+void tst_QCommandHistorySearch::findBytesAtPageEnd()
+{
+    QFETCH(int, simd);
+    if(qCommandEditSetSimd(QCommandEditSimd(simd)) != simd)
+        QSKIP("instruction set not supported");
+
+#if defined(Q_OS_UNIX)
+    long pageSize = sysconf(_SC_PAGESIZE);
+    void *pages = mmap(nullptr, size_t(2 * pageSize), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    QVERIFY(pages != MAP_FAILED);
+    char *end = static_cast<char*>(pages) + pageSize;
+    QCOMPARE(mprotect(end, size_t(pageSize), PROT_NONE), 0);
+    memset(pages, 'x', size_t(pageSize));
+
+    bool ok = true;
+    for(int m = 1; m <= 40 && ok; m++)
+    {
+        QByteArray needle(m, 'n');
+        needle[m - 1] = 'e';
+        memcpy(end - m, needle.constData(), size_t(m));
+        for(int n = m; n <= m + 70 && ok; n++)
+        {
+            // at the very end, and missing its last byte
+            const char *hay = end - n;
+            ok = qCommandEditFindBytes(hay, n, needle.constData(), m) == end - m
+                    && qCommandEditFindBytes(hay, n - 1, needle.constData(), m) == nullptr;
+            if(!ok)
+                qWarning("needle of %d bytes, haystack of %d bytes", m, n);
+        }
+        memset(end - m, 'x', size_t(m));
+    }
+    munmap(pages, size_t(2 * pageSize));
+    QVERIFY(ok);
+#else
+    QSKIP("needs mmap()");
+#endif
+}
+
+void tst_QCommandHistorySearch::search_data()
+{
+    addSimdLevels();
+}
+
+/*
+ * Random entries (stored as Latin-1 or UTF-8) and queries, substring and
+ * fuzzy, from random positions.
+ */
+void tst_QCommandHistorySearch::search()
+{
+    QFETCH(int, simd);
+    if(qCommandEditSetSimd(QCommandEditSimd(simd)) != simd)
+        QSKIP("instruction set not supported");
+
+    quint32 state = 88675123u;
+    QStringList entries;
+    for(int i = 0; i < 2000; i++)
+        entries << randomText(state, 1 + int(nextRandom(state) % 120));
+    QCommandHistory history;
+    history.set(entries);
+
+    // a search which may reuse the results of the previous query, and a new
+    // search for each query
+    QCommandHistorySearch reused;
+    for(int iteration = 0; iteration < 500; iteration++)
+    {
+        // a part of an entry, or random text
+        QString query;
+        int length = 1 + int(nextRandom(state) % 50);
+        const QString &entry = entries.at(int(nextRandom(state) % quint32(entries.size())));
+        if(nextRandom(state) % 4 && length <= entry.length())
+            query = entry.mid(int(nextRandom(state) % quint32(entry.length() - length + 1)), length);
+        else
+            query = randomText(state, length % 8 + 1);
+
+        QCommandHistorySearch::Mode mode = nextRandom(state) % 4 ? QCommandHistorySearch::Substring : QCommandHistorySearch::Fuzzy;
+        int from = int(nextRandom(state) % quint32(entries.size() + 2));
+
+        QCommandHistorySearch search;
+        int expected = expectedMatch(entries, query, mode, from);
+        QCOMPARE(search.search(history, query, mode, from), expected);
+        QCOMPARE(reused.search(history, query, mode, from), expected);
+    }
+}
+
+void tst_QCommandHistorySearch::narrowAndWiden_data()
+{
+    addSimdLevels();
+}
+
+/*
+ * Type a query one char at a time (narrowing the candidates), then delete
+ * it one char at a time, with entries appended meanwhile.
+ */
+void tst_QCommandHistorySearch::narrowAndWiden()
+{
+    QFETCH(int, simd);
+    if(qCommandEditSetSimd(QCommandEditSimd(simd)) != simd)
+        QSKIP("instruction set not supported");
+
+    quint32 state = 123456789u;
+    QStringList entries;
+    for(int i = 0; i < 1000; i++)
+        entries << randomText(state, 1 + int(nextRandom(state) % 60));
+    QCommandHistory history;
+    history.set(entries);
+
+    QCommandHistorySearch search;
+    for(int round = 0; round < 50; round++)
+    {
+        const QString &entry = entries.at(int(nextRandom(state) % quint32(entries.size())));
+        QString target = entry.mid(int(nextRandom(state) % quint32(entry.length())), 40);
+        QCommandHistorySearch::Mode mode = round % 3 ? QCommandHistorySearch::Substring : QCommandHistorySearch::Fuzzy;
+
+        QStringList queries;
+        for(int length = 1; length <= target.length(); length++)
+            queries << target.left(length);
+        for(int length = target.length() - 1; length >= 1; length--)
+            queries << target.left(length);
+
+        for(const QString &query : queries)
+        {
+            if(nextRandom(state) % 8 == 0)
+            {
+                QString appended = randomText(state, 1 + int(nextRandom(state) % 60));
+                entries << appended;
+                history.append(appended);
+            }
+            int from = nextRandom(state) % 2 ? entries.size() : int(nextRandom(state) % quint32(entries.size() + 1));
+            QCOMPARE(search.search(history, query, mode, from), expectedMatch(entries, query, mode, from));
+        }
+    }
+}
+
+QTEST_GUILESS_MAIN(tst_QCommandHistorySearch)
+
+#include "tst_qcommandhistorysearch.moc"
@@ -0,0 +1,234 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <QtTest>
+
+#include "qcommandtokenizer.h"
+#include "qshellcommandtokenizer.h"
+
+// a tokenizer written for the QList<Token> storage: it only overrides
+// tokenize(), and gives words without their double quotes
+class LegacyTokenizer : public QCommandTokenizer
+{
+protected:
+    void tokenize()
+    {
+        int start = 0;
+        for(int i = 0; i <= command_.length(); i++)
+        {
+            if(i < command_.length() && command_.at(i) != ' ')
+                continue;
+            if(i > start)
+            {
+                Token t;
+                t.token_ = command_.mid(start, i - start);
+                t.token_.remove('"');
+                t.type_ = 0;
+                t.start_ = start;
+                t.end_ = i;
+                tokens_.append(t);
+            }
+            start = i + 1;
+        }
+    }
+};
+
+class tst_QCommandTokenizer : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void applyEdit_data();
+    void applyEdit();
+    void appendInput_data();
+    void appendInput();
+    void appendInputAfterEdit();
+
+private:
+    static QCommandTokenizer * createTokenizer(const QString &kind);
+    static QStringList describe(const QList<QCommandTokenizer::Token> &tokens, int first, int last, int delta);
+    static void addRow(const QString &kind, const char *name, const QString &command, int pos, int removed, const QString &inserted);
+};
+
+QCommandTokenizer * tst_QCommandTokenizer::createTokenizer(const QString &kind)
+{
+    if(kind == QLatin1String("shell"))
+        return new QShellCommandTokenizer;
+    if(kind == QLatin1String("legacy"))
+        return new LegacyTokenizer;
+    return new QSimpleCommandTokenizer;
+}
+
+// tokens [first, last), as "type start-end text", with offsets shifted by delta
+QStringList tst_QCommandTokenizer::describe(const QList<QCommandTokenizer::Token> &tokens, int first, int last, int delta)
+{
+    QStringList result;
+    for(int i = first; i < last; i++)
+    {
+        const QCommandTokenizer::Token &t = tokens.at(i);
+        result << QString("%1 %2-%3 %4").arg(t.type_).arg(t.start_ + delta).arg(t.end_ + delta).arg(t.token_);
+    }
+    return result;
+}
+
+void tst_QCommandTokenizer::addRow(const QString &kind, const char *name, const QString &command, int pos, int removed, const QString &inserted)
+{
+    QTest::newRow(qPrintable(QString("%1: %2").arg(kind, QLatin1String(name)))) << kind << command << pos << removed << inserted;
+}
+
+void tst_QCommandTokenizer::applyEdit_data()
+{
+    QTest::addColumn<QString>("kind");
+    QTest::addColumn<QString>("command");
+    QTest::addColumn<int>("pos");
+    QTest::addColumn<int>("removed");
+    QTest::addColumn<QString>("inserted");
+
+    for(const QString &kind : QStringList({"simple", "shell", "legacy"}))
+    {
+        addRow(kind, "insert at token start", "ls -l /tmp", 3, 0, "x");
+        addRow(kind, "insert at token end", "ls -l /tmp", 2, 0, "s");
+        addRow(kind, "insert inside token", "ls -l /tmp", 4, 0, "al");
+        addRow(kind, "delete at token start", "ls -l /tmp", 3, 1, "");
+        addRow(kind, "delete at token end", "ls -l /tmp", 4, 1, "");
+        addRow(kind, "delete whole token", "ls -l /tmp", 3, 2, "");
+        addRow(kind, "insert between separators", "ls  /tmp", 3, 0, "-a");
+        addRow(kind, "delete between separators", "ls   /tmp", 3, 1, "");
+        addRow(kind, "delete separator", "ls -l /tmp", 2, 1, "");
+        addRow(kind, "insert separator", "ls -l /tmp", 1, 0, " ");
+        addRow(kind, "replace across tokens", "ls -l /tmp", 1, 6, "x y");
+        addRow(kind, "insert at end of line", "ls -l /tmp", 10, 0, "/x");
+        addRow(kind, "insert word at end of line", "ls -l /tmp", 10, 0, " x");
+        addRow(kind, "insert after trailing blank", "ls -l ", 6, 0, "x");
+        addRow(kind, "delete at end of line", "ls -l /tmp", 9, 1, "");
+        addRow(kind, "insert at start of line", "ls -l", 0, 0, "x");
+        addRow(kind, "insert in empty command", "", 0, 0, "ls -l");
+        addRow(kind, "delete everything", "ls -l", 0, 5, "");
+        addRow(kind, "insert quote", "echo a b", 5, 0, "\"");
+    }
+
+    addRow("shell", "close quote", "echo \"a b", 9, 0, "\"");
+    addRow("shell", "close quote before tail", "echo \"a b; ls", 9, 0, "\"");
+    addRow("shell", "open quote", "echo a b; ls -l", 5, 0, "\"");
+    addRow("shell", "open single quote", "echo a b; ls -l", 5, 0, "'");
+    addRow("shell", "remove opening quote", "echo \"a b\" c", 5, 1, "");
+    addRow("shell", "remove closing quote", "echo \"a b\" c; ls", 9, 1, "");
+    addRow("shell", "quote inside quotes", "echo \"a 'b' c\" d", 8, 0, "\"");
+    addRow("shell", "operator merge >>", "a>b", 1, 0, ">");
+    addRow("shell", "operator split >>", "a>>b", 1, 1, "");
+    addRow("shell", "operator merge ||", "a|b", 2, 0, "|");
+    addRow("shell", "operator merge &&", "a&b", 1, 0, "&");
+    addRow("shell", "operator split by blank", "a&&b", 2, 0, " ");
+    addRow("shell", "operator to word", "a>b c", 1, 1, "x");
+    addRow("shell", "insert operator in word", "abc def", 1, 0, ";");
+    addRow("shell", "insert escape", "echo a b", 6, 0, "\\");
+    addRow("shell", "remove escape", "echo a\\ b c", 6, 1, "");
+    addRow("shell", "escaped quote", "echo \"a\\\" b\" c", 7, 1, "");
+    addRow("shell", "insert newline", "ls -l /tmp", 5, 0, "\n");
+}
+
+void tst_QCommandTokenizer::applyEdit()
+{
+    QFETCH(QString, kind);
+    QFETCH(QString, command);
+    QFETCH(int, pos);
+    QFETCH(int, removed);
+    QFETCH(QString, inserted);
+
+    QScopedPointer<QCommandTokenizer> tokenizer(createTokenizer(kind));
+    tokenizer->setCommand(command);
+    QList<QCommandTokenizer::Token> before = tokenizer->getTokens();
+    QCommandTokenizer::TokenChange change = tokenizer->applyEdit(pos, removed, inserted);
+    QList<QCommandTokenizer::Token> after = tokenizer->getTokens();
+
+    // the same tokens as tokenizing the edited command from scratch:
+    QString edited = command;
+    edited.replace(pos, removed, inserted);
+    QScopedPointer<QCommandTokenizer> expected(createTokenizer(kind));
+    expected->setCommand(edited);
+    QList<QCommandTokenizer::Token> expectedTokens = expected->getTokens();
+    QCOMPARE(describe(after, 0, after.size(), 0), describe(expectedTokens, 0, expectedTokens.size(), 0));
+
+    // and the change covers all the tokens which differ:
+    int delta = inserted.length() - removed;
+    QCOMPARE(after.size(), before.size() - change.removed_ + change.inserted_);
+    QCOMPARE(describe(after, 0, change.first_, 0), describe(before, 0, change.first_, 0));
+    QCOMPARE(describe(after, change.first_ + change.inserted_, after.size(), 0),
+             describe(before, change.first_ + change.removed_, before.size(), delta));
+}
+
+void tst_QCommandTokenizer::appendInput_data()
+{
+    // an empty chunk stands for finishInput()
+    QTest::addColumn<QString>("command");
+    QTest::addColumn<QStringList>("chunks");
+
+    QTest::newRow("chunks") << QString("") << QStringList({"ec", "ho a", "b > f", "ile", ""});
+    QTest::newRow("unfinished") << QString("") << QStringList({"ls -l /t", "mp"});
+    QTest::newRow("after setCommand") << QString("ec") << QStringList({"ho"});
+    QTest::newRow("after finishInput") << QString("") << QStringList({"echo a", "", "b", ""});
+    QTest::newRow("after blank") << QString("echo ") << QStringList({"a"});
+    QTest::newRow("operator continued") << QString("a >") << QStringList({"> b"});
+    QTest::newRow("operator ended") << QString("a;") << QStringList({";b"});
+    QTest::newRow("quote continued") << QString("echo \"a") << QStringList({" b\" c", ""});
+    QTest::newRow("escape continued") << QString("echo a\\") << QStringList({" b"});
+}
+
+void tst_QCommandTokenizer::appendInput()
+{
+    QFETCH(QString, command);
+    QFETCH(QStringList, chunks);
+
+    QShellCommandTokenizer tokenizer;
+    tokenizer.setCommand(command);
+    QString full = command;
+    for(const QString &chunk : chunks)
+    {
+        if(chunk.isEmpty())
+            tokenizer.finishInput();
+        else
+            tokenizer.appendInput(chunk);
+        full += chunk;
+    }
+    tokenizer.finishInput();
+
+    QShellCommandTokenizer expected;
+    expected.setCommand(full);
+    QCOMPARE(describe(tokenizer.getTokens(), 0, tokenizer.count(), 0), describe(expected.getTokens(), 0, expected.count(), 0));
+}
+
+void tst_QCommandTokenizer::appendInputAfterEdit()
+{
+    QShellCommandTokenizer tokenizer;
+    tokenizer.setCommand("ls -l");
+    tokenizer.appendInput(" /t");
+    tokenizer.applyEdit(0, 2, "echo");
+    tokenizer.appendInput("mp");
+    tokenizer.finishInput();
+
+    QShellCommandTokenizer expected;
+    expected.setCommand("echo -l /tmp");
+    QCOMPARE(describe(tokenizer.getTokens(), 0, tokenizer.count(), 0), describe(expected.getTokens(), 0, expected.count(), 0));
+
+    tokenizer.clear();
+    tokenizer.appendInput("pwd");
+    tokenizer.finishInput();
+    QCOMPARE(describe(tokenizer.getTokens(), 0, tokenizer.count(), 0), QStringList({"0 0-3 pwd"}));
+}
+
+QTEST_GUILESS_MAIN(tst_QCommandTokenizer)
+
+#include "tst_qcommandtokenizer.moc"
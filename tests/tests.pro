@@ -0,0 +1,13 @@
+# QCommandEdit - a command input widget with history and tab completion
+# Copyright (C) 2018 Federico Ferri
+#
+# QtTest unit tests; run with e.g.:
+#   qmake && make && make check
+
+TEMPLATE = subdirs
+
+SUBDIRS += \
+    qcommandhistory \
+    qcommandhistoryjournal \
+    qcommandhistorysearch \
+    qcommandtokenizer
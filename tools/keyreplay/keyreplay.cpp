@@ -0,0 +1,391 @@
+/* QCommandEdit - a widget for entering commands, with completion and history
+ * Copyright (C) 2018 Federico Ferri
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+/*
+ * keyreplay: record keystroke scripts from a live QCommandEdit, and replay
+ * them (offscreen by default) measuring for every event the time spent
+ * handling it (eventFilter + keyPressEvent) and the time until the end of the
+ * following paint. Prints p50/p99/max per action type.
+ *
+ * Script format, one event per line:
+ *
+ *     <delay ms> type <text>     typed text, one key press per character
+ *     <delay ms> key <sequence>  a key, as a QKeySequence string (Tab, Up, Ctrl+R...)
+ *     <delay ms> paste <text>    text pasted (with Ctrl+V) at once
+ *
+ * where delay is the time since the previous event, and text is escaped
+ * (\n, \t, \r, \\). Lines starting with # are comments.
+ */
+#include <QApplication>
+#include <QClipboard>
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QKeyEvent>
+#include <QKeySequence>
+#include <QMap>
+#include <QSharedPointer>
+#include <QTextStream>
+#include <QThread>
+
+#include <algorithm>
+#include <cmath>
+
+#include "qcommandcompletionindex.h"
+#include "qcommandedit.h"
+#include "qtablecommandtokenizer.h"
+
+struct ScriptEvent
+{
+    qint64 delay_;
+    QString action_;
+    QString arg_;
+};
+
+static QString escape(const QString &s)
+{
+    QString r;
+    for(QChar c : s)
+    {
+        if(c == '\\') r += "\\\\";
+        else if(c == '\n') r += "\\n";
+        else if(c == '\t') r += "\\t";
+        else if(c == '\r') r += "\\r";
+        else r += c;
+    }
+    return r;
+}
+
+static QString unescape(const QString &s)
+{
+    QString r;
+    for(int i = 0; i < s.length(); i++)
+    {
+        QChar c = s.at(i);
+        if(c == '\\' && i + 1 < s.length())
+        {
+            QChar d = s.at(++i);
+            r += d == 'n' ? QChar('\n') : d == 't' ? QChar('\t') : d == 'r' ? QChar('\r') : d;
+        }
+        else r += c;
+    }
+    return r;
+}
+
+static bool readScript(const QString &fileName, QVector<ScriptEvent> &script)
+{
+    QFile f(fileName);
+    if(!f.open(QIODevice::ReadOnly | QIODevice::Text))
+        return false;
+    QTextStream in(&f);
+    in.setCodec("UTF-8");
+    int lineNumber = 0;
+    while(!in.atEnd())
+    {
+        QString line = in.readLine();
+        lineNumber++;
+        if(line.isEmpty() || line.startsWith('#')) continue;
+        int a = line.indexOf(' '), b = a < 0 ? -1 : line.indexOf(' ', a + 1);
+        bool ok = false;
+        ScriptEvent e;
+        e.delay_ = a > 0 ? line.left(a).toLongLong(&ok) : 0;
+        e.action_ = line.mid(a + 1, b < 0 ? -1 : b - a - 1);
+        e.arg_ = b < 0 ? QString() : unescape(line.mid(b + 1));
+        if(!ok || (e.action_ != QLatin1String("type") && e.action_ != QLatin1String("key") && e.action_ != QLatin1String("paste")))
+        {
+            QTextStream(stderr) << fileName << ":" << lineNumber << ": invalid event\n";
+            return false;
+        }
+        script.append(e);
+    }
+    return true;
+}
+
+/*
+ * Records key presses of the edit as script events.
+ */
+class Recorder : public QObject
+{
+public:
+    Recorder(QTextStream *out) : out_(out) { timer_.start(); }
+
+protected:
+    bool eventFilter(QObject *obj, QEvent *event)
+    {
+        if(event->type() == QEvent::KeyPress)
+        {
+            QKeyEvent *k = static_cast<QKeyEvent*>(event);
+            qint64 delay = timer_.restart();
+            Qt::KeyboardModifiers mods = k->modifiers() & ~Qt::KeypadModifier;
+            if(k->matches(QKeySequence::Paste))
+                *out_ << delay << " paste " << escape(QApplication::clipboard()->text()) << "\n";
+            else if(!k->text().isEmpty() && k->text().at(0).isPrint()
+                    && !(mods & (Qt::ControlModifier | Qt::AltModifier | Qt::MetaModifier)))
+                *out_ << delay << " type " << escape(k->text()) << "\n";
+            else if(k->key() != Qt::Key_Shift && k->key() != Qt::Key_Control
+                    && k->key() != Qt::Key_Alt && k->key() != Qt::Key_Meta)
+                *out_ << delay << " key " << QKeySequence(int(mods) | k->key()).toString() << "\n";
+            out_->flush();
+        }
+        return QObject::eventFilter(obj, event);
+    }
+
+private:
+    QTextStream *out_;
+    QElapsedTimer timer_;
+};
+
+/*
+ * Replays a script, and collects the latencies.
+ */
+class Player
+{
+public:
+    Player(QCommandEdit *edit, int paintTimeout)
+        : edit_(edit),
+          paintTimeout_(paintTimeout),
+          lastPaint_(-1)
+    {
+        QSharedPointer<QCommandEditProfiler> profiler(new QCommandEditProfiler);
+        edit_->setProfiler(profiler);
+        QObject::connect(edit_, &QCommandEdit::latencyMeasured, [this](QCommandEditProfiler::Stage stage, qint64) {
+            if(stage == QCommandEditProfiler::Paint)
+                lastPaint_ = clock_.nsecsElapsed();
+        });
+        clock_.start();
+    }
+
+    void play(const ScriptEvent &e)
+    {
+        if(e.action_ == QLatin1String("type"))
+        {
+            for(QChar c : e.arg_)
+            {
+                int key = c.unicode() < 128 ? c.toUpper().unicode() : int(Qt::Key_unknown);
+                Qt::KeyboardModifiers mods = c.isUpper() ? Qt::ShiftModifier : Qt::NoModifier;
+                sendKey("type", key, mods, QString(c));
+            }
+        }
+        else if(e.action_ == QLatin1String("paste"))
+        {
+            QApplication::clipboard()->setText(e.arg_);
+            QKeySequence paste(QKeySequence::Paste);
+            sendKey("paste", paste[0] & ~Qt::KeyboardModifierMask, Qt::KeyboardModifiers(QFlag(paste[0] & Qt::KeyboardModifierMask)), QString());
+        }
+        else
+        {
+            QKeySequence seq(e.arg_);
+            if(seq.isEmpty()) return;
+            int k = seq[0] & ~Qt::KeyboardModifierMask;
+            Qt::KeyboardModifiers mods(QFlag(seq[0] & Qt::KeyboardModifierMask));
+            QString text = k == Qt::Key_Return ? QString("\r") : QString();
+            sendKey(e.arg_.toLower(), k, mods, text);
+        }
+    }
+
+    void report(QTextStream &out, bool csv) const
+    {
+        if(csv)
+            out << "action,count,handle_p50_us,handle_p99_us,handle_max_us,painted,paint_p50_us,paint_p99_us,paint_max_us\n";
+        else
+            out << QString("%1 %2 %3 %4 %5 %6 %7 %8 %9\n")
+                   .arg("action", -12).arg("count", 7)
+                   .arg("handle p50", 11).arg("p99", 9).arg("max", 9)
+                   .arg("painted", 8).arg("paint p50", 10).arg("p99", 9).arg("max", 9)
+                << "(microseconds)\n";
+        for(auto it = handle_.cbegin(); it != handle_.cend(); ++it)
+        {
+            const QVector<qint64> &h = it.value();
+            QVector<qint64> p = paint_.value(it.key());
+            QStringList cols;
+            cols << it.key() << QString::number(h.size())
+                 << us(percentile(h, 0.5)) << us(percentile(h, 0.99)) << us(percentile(h, 1))
+                 << QString::number(p.size())
+                 << us(percentile(p, 0.5)) << us(percentile(p, 0.99)) << us(percentile(p, 1));
+            if(csv)
+                out << cols.join(',') << "\n";
+            else
+                out << QString("%1 %2 %3 %4 %5 %6 %7 %8 %9\n")
+                       .arg(cols[0], -12).arg(cols[1], 7).arg(cols[2], 11).arg(cols[3], 9).arg(cols[4], 9)
+                       .arg(cols[5], 8).arg(cols[6], 10).arg(cols[7], 9).arg(cols[8], 9);
+        }
+    }
+
+private:
+    void sendKey(const QString &action, int key, Qt::KeyboardModifiers mods, const QString &text)
+    {
+        lastPaint_ = -1;
+        qint64 start = clock_.nsecsElapsed();
+        QKeyEvent press(QEvent::KeyPress, key, mods, text);
+        QApplication::sendEvent(edit_, &press);
+        QKeyEvent release(QEvent::KeyRelease, key, mods, text);
+        QApplication::sendEvent(edit_, &release);
+        handle_[action].append(clock_.nsecsElapsed() - start);
+
+        // let the widget paint (repaints are posted); give up after
+        // paintTimeout_ if nothing needs to be painted
+        QElapsedTimer wait;
+        wait.start();
+        do
+        {
+            QApplication::processEvents(QEventLoop::AllEvents, 1);
+            if(lastPaint_ >= 0) break;
+            QThread::usleep(50);
+        } while(wait.elapsed() < paintTimeout_);
+        if(lastPaint_ >= 0)
+            paint_[action].append(lastPaint_ - start);
+    }
+
+    static qint64 percentile(QVector<qint64> v, double p)
+    {
+        if(v.isEmpty()) return -1;
+        std::sort(v.begin(), v.end());
+        int i = qBound(0, int(std::ceil(p * v.size())) - 1, v.size() - 1);
+        return v[i];
+    }
+
+    static QString us(qint64 ns)
+    {
+        return ns < 0 ? QString("-") : QString::number(double(ns) / 1000.0, 'f', 1);
+    }
+
+    QCommandEdit *edit_;
+    int paintTimeout_;
+    QElapsedTimer clock_;
+    qint64 lastPaint_;
+    QMap<QString, QVector<qint64> > handle_;
+    QMap<QString, QVector<qint64> > paint_;
+};
+
+static QStringList readLines(const QString &fileName)
+{
+    QStringList lines;
+    QFile f(fileName);
+    if(f.open(QIODevice::ReadOnly | QIODevice::Text))
+    {
+        QTextStream in(&f);
+        in.setCodec("UTF-8");
+        while(!in.atEnd())
+            lines << in.readLine();
+    }
+    return lines;
+}
+
+int main(int argc, char *argv[])
+{
+    bool record = false;
+    for(int i = 1; i < argc; i++)
+        if(QByteArray(argv[i]) == "--record")
+            record = true;
+    if(!record && !qEnvironmentVariableIsSet("QT_QPA_PLATFORM"))
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+
+    QApplication app(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Record and replay keystroke scripts on a QCommandEdit, measuring input latency.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("script", "Script file to replay, or to write when recording.");
+    QCommandLineOption recordOption("record", "Record a script from a live session.");
+    QCommandLineOption rateOption("rate", "Replay at a fixed rate of <n> events per second.", "n");
+    QCommandLineOption realtimeOption("realtime", "Replay with the recorded delays.");
+    QCommandLineOption historyOption("history", "Load history entries from <file> (one per line).", "file");
+    QCommandLineOption historySizeOption("history-size", "Generate a history of <n> entries.", "n");
+    QCommandLineOption wordsOption("words", "Complete words from <file> (one per line).", "file");
+    QCommandLineOption paintTimeoutOption("paint-timeout", "Wait at most <ms> for a paint after each event (default 20).", "ms", "20");
+    QCommandLineOption csvOption("csv", "Print results as CSV.");
+    parser.addOptions({recordOption, rateOption, realtimeOption, historyOption, historySizeOption,
+                       wordsOption, paintTimeoutOption, csvOption});
+    parser.process(app);
+    if(parser.positionalArguments().size() != 1)
+        parser.showHelp(1);
+    QString scriptFile = parser.positionalArguments().first();
+
+    QCommandEdit edit;
+    edit.setShowMatchingHistory(true);
+    QStringList history;
+    if(parser.isSet(historyOption))
+        history = readLines(parser.value(historyOption));
+    for(int i = 0, n = parser.value(historySizeOption).toInt(); i < n; i++)
+        history << QString("command%1 --arg=%2").arg(i % 997).arg(i);
+    edit.setHistory(history);
+
+    QCommandCompletionIndex words(readLines(parser.value(wordsOption)));
+    QObject::connect(&edit, &QCommandEdit::askCompletion, [&](const QString &cmd, int cursorPos) {
+        QTableCommandTokenizer<> t;
+        t.setCommand(cmd);
+        QCommandTokenizer::TokenLookup lookup = t.findToken(cursorPos);
+        QString prefix = lookup.kind_ == QCommandTokenizer::TokenLookup::InToken
+                ? t.tokenAt(lookup.index_).token_.left(cursorPos - t.tokenAt(lookup.index_).start_).toString()
+                : QString();
+        edit.setCompletion(words.complete(prefix));
+    });
+    QObject::connect(&edit, &QCommandEdit::execute, [&](const QString &cmd) {
+        edit.clear();
+        edit.appendHistory(cmd);
+    });
+
+    if(parser.isSet(recordOption))
+    {
+        QFile f(scriptFile);
+        if(!f.open(QIODevice::WriteOnly | QIODevice::Text | QIODevice::Truncate))
+        {
+            QTextStream(stderr) << "cannot write " << scriptFile << "\n";
+            return 1;
+        }
+        QTextStream out(&f);
+        out.setCodec("UTF-8");
+        out << "# recorded by keyreplay\n";
+        Recorder recorder(&out);
+        edit.installEventFilter(&recorder);
+        edit.resize(600, edit.sizeHint().height());
+        edit.show();
+        return app.exec();
+    }
+
+    QVector<ScriptEvent> script;
+    if(!readScript(scriptFile, script))
+    {
+        QTextStream(stderr) << "cannot read " << scriptFile << "\n";
+        return 1;
+    }
+
+    edit.resize(600, edit.sizeHint().height());
+    edit.show();
+    edit.activateWindow();
+    edit.setFocus();
+    QApplication::processEvents();
+
+    Player player(&edit, parser.value(paintTimeoutOption).toInt());
+    double rate = parser.value(rateOption).toDouble();
+    QElapsedTimer clock;
+    clock.start();
+    qint64 due = 0; // ms
+    for(int i = 0; i < script.size(); i++)
+    {
+        if(parser.isSet(realtimeOption))
+            due += script[i].delay_;
+        else if(rate > 0)
+            due = qint64(1000.0 * i / rate);
+        while(clock.elapsed() < due)
+            QApplication::processEvents(QEventLoop::AllEvents, int(due - clock.elapsed()));
+        player.play(script[i]);
+    }
+
+    QTextStream out(stdout);
+    player.report(out, parser.isSet(csvOption));
+    return 0;
+}
@@ -0,0 +1,17 @@
+# QCommandEdit - a command input widget with history and tab completion
+# Copyright (C) 2018 Federico Ferri
+#
+# Keystroke record/replay harness; see keyreplay --help
+
+QT += widgets concurrent
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+TARGET = keyreplay
+TEMPLATE = app
+
+include(../../qcommandedit.pri)
+
+SOURCES += \
+    keyreplay.cpp